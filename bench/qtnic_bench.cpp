@@ -0,0 +1,548 @@
+// qtnic_bench: synthetic interface sets of growing size pushed through the
+// same code paths the app uses, results printed as json so they can be
+// diffed between builds.
+
+#include "apply_executor.h"
+#include "interface_model.h"
+#include "name_index.h"
+#include "name_suggester.h"
+#include "nic_private.h"
+#include "route_table.h"
+
+#include <QString>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <format>
+#include <limits>
+#include <print>
+#include <random>
+#include <sstream>
+#include <unordered_map>
+
+#include "rapidjson/prettywriter.h"
+#include "rapidjson/stringbuffer.h"
+
+using Clock = std::chrono::steady_clock;
+using Json_Writer = rapidjson::PrettyWriter<rapidjson::StringBuffer>;
+
+// NOTE: keeps the optimizer from throwing the measured work away
+static volatile u64 sink = 0;
+
+
+struct Synthetic_Adapters
+{
+    // NOTE: everything is reserved upfront, the adapters point into these
+    vec<IP_ADAPTER_ADDRESSES> adapters;
+    vec<IP_ADAPTER_UNICAST_ADDRESS_LH> unicast;
+    vec<IP_ADAPTER_GATEWAY_ADDRESS_LH> gateways;
+    vec<IP_ADAPTER_DNS_SERVER_ADDRESS_XP> dns;
+    vec<sockaddr_in> sockaddrs;
+    vec<sockaddr_in6> sockaddrs_v6;
+    vec<wstr> strings;
+
+    IP_ADAPTER_ADDRESSES* first() { return adapters.data(); }
+};
+
+struct Bench_Options
+{
+    vec<u32> sizes {10, 100, 1'000, 10'000, 100'000};
+    u32 replay_us {1'000};
+    str out_path;
+};
+
+
+static sockaddr_in* make_ipv4(Synthetic_Adapters& set, u32 addr)
+{
+    sockaddr_in sa {};
+    sa.sin_family = AF_INET;
+    sa.sin_addr.s_addr = htonl(addr);
+    set.sockaddrs.push_back(sa);
+    return &set.sockaddrs.back();
+}
+
+static sockaddr_in6* make_ipv6(Synthetic_Adapters& set, u32 suffix)
+{
+    sockaddr_in6 sa {};
+    sa.sin6_family = AF_INET6;
+    sa.sin6_addr.s6_addr[0] = 0xfe; // fe80::suffix
+    sa.sin6_addr.s6_addr[1] = 0x80;
+    sa.sin6_addr.s6_addr[12] = u8(suffix >> 24);
+    sa.sin6_addr.s6_addr[13] = u8(suffix >> 16);
+    sa.sin6_addr.s6_addr[14] = u8(suffix >> 8);
+    sa.sin6_addr.s6_addr[15] = u8(suffix);
+    set.sockaddrs_v6.push_back(sa);
+    return &set.sockaddrs_v6.back();
+}
+
+static wchar_t* make_string(Synthetic_Adapters& set, wstr s)
+{
+    set.strings.push_back(std::move(s));
+    return set.strings.back().data();
+}
+
+Synthetic_Adapters make_synthetic_adapters(u32 count)
+{
+    static const wchar_t* const prefixes[] = {
+        L"Ethernet",
+        L"Wi-Fi",
+        L"\u0421\u0435\u0442\u044c", // russian
+        L"\u4ee5\u592a\u7f51", // chinese
+        L"VPN \u2013 B\u00fcro",
+        L"vEthernet (WSL \u2713)",
+    };
+    constexpr u32 prefix_count = sizeof(prefixes) / sizeof(prefixes[0]);
+    constexpr u32 max_unicast = 3;
+    constexpr u32 dns_per_adapter = 2;
+
+    Synthetic_Adapters set;
+    set.adapters.resize(count);
+    set.unicast.reserve(count * (max_unicast + 1));
+    set.gateways.reserve(count);
+    set.dns.reserve(count * dns_per_adapter);
+    set.sockaddrs.reserve(count * (max_unicast + 1 + dns_per_adapter));
+    set.sockaddrs_v6.reserve(count);
+    set.strings.reserve(count * 3);
+
+    for (u32 i = 0; i < count; ++i)
+    {
+        auto& adapter = set.adapters[i];
+        u32 subnet = 0x0A000000 | ((i & 0xFFFF) << 8); // 10.x.y.0
+
+        adapter.Next = (i + 1 < count) ? &set.adapters[i + 1] : nullptr;
+        adapter.FriendlyName = make_string(
+            set, std::format(L"{} {}", prefixes[i % prefix_count], i));
+        adapter.Description = make_string(
+            set, std::format(L"Synthetic Network Adapter #{}", i));
+        adapter.DnsSuffix = make_string(set, L"lab.example");
+        adapter.OperStatus = (i % 4 == 0) ? IfOperStatusDown : IfOperStatusUp;
+        adapter.Ipv4Metric = 5 + (i % 50);
+        adapter.Ipv6Metric = 5 + (i % 50);
+        adapter.Flags = IP_ADAPTER_IPV4_ENABLED | IP_ADAPTER_IPV6_ENABLED;
+        adapter.IfIndex = i + 1;
+        adapter.Luid.Value = 0x1000 + i;
+
+        // multiple addresses per adapter, like hosts with secondary IPs
+        u32 unicast_count = 1 + (i % max_unicast);
+        for (u32 a = 0; a < unicast_count; ++a)
+        {
+            auto& unicast = set.unicast.emplace_back();
+            unicast.Address.lpSockaddr = reinterpret_cast<SOCKADDR*>(make_ipv4(set, subnet | (a + 10)));
+            unicast.Address.iSockaddrLength = sizeof(sockaddr_in);
+            unicast.OnLinkPrefixLength = 24;
+            unicast.Next = nullptr;
+
+            if (a == 0)
+                adapter.FirstUnicastAddress = &unicast;
+            else
+                (&unicast - 1)->Next = &unicast;
+        }
+
+        // plus a link-local IPv6 one, dual-stack is the common case
+        auto& unicast_v6 = set.unicast.emplace_back();
+        unicast_v6.Address.lpSockaddr = reinterpret_cast<SOCKADDR*>(make_ipv6(set, i + 1));
+        unicast_v6.Address.iSockaddrLength = sizeof(sockaddr_in6);
+        unicast_v6.OnLinkPrefixLength = 64;
+        unicast_v6.Next = nullptr;
+        (&unicast_v6 - 1)->Next = &unicast_v6;
+
+        auto& gateway = set.gateways.emplace_back();
+        gateway.Address.lpSockaddr = reinterpret_cast<SOCKADDR*>(make_ipv4(set, subnet | 1));
+        gateway.Address.iSockaddrLength = sizeof(sockaddr_in);
+        adapter.FirstGatewayAddress = &gateway;
+
+        for (u32 d = 0; d < dns_per_adapter; ++d)
+        {
+            auto& dns = set.dns.emplace_back();
+            dns.Address.lpSockaddr = reinterpret_cast<SOCKADDR*>(make_ipv4(set, 0x08080808 + d));
+            dns.Address.iSockaddrLength = sizeof(sockaddr_in);
+            dns.Next = nullptr;
+
+            if (d == 0)
+                adapter.FirstDnsServerAddress = &dns;
+            else
+                (&dns - 1)->Next = &dns;
+        }
+    }
+
+    return set;
+}
+
+vec<shared<Interface>> parse_synthetic_adapters(Synthetic_Adapters& set)
+{
+    vec<shared<Interface>> interfaces;
+
+    for (auto* adapter = set.first();
+         adapter != nullptr;
+         adapter = adapter->Next)
+    {
+        interfaces.push_back(std::make_shared<Interface>(parse_adapter(adapter)));
+    }
+
+    return interfaces;
+}
+
+// NOTE: worst case for the matcher, the list comes back reversed
+str make_reversed_nic_list(const vec<shared<Interface>>& interfaces)
+{
+    str nic_list;
+
+    for (auto it = interfaces.rbegin(); it != interfaces.rend(); ++it)
+    {
+        nic_list.append((*it)->name.c_str()).append("\n");
+    }
+
+    return nic_list;
+}
+
+// NOTE: 200 rules and no names, half globs half regexes, every one of
+// them matching somewhere in the synthetic sets
+static str make_rule_list()
+{
+    str rules;
+
+    for (u32 i = 0; i < 100; ++i)
+    {
+        rules.append(std::format("re:(Ethernet|Wi-Fi) {}\\d*\n", i));
+        rules.append(std::format("glob:*{}\n", 99 - i));
+    }
+
+    return rules;
+}
+
+// NOTE: a route per interface plus a mix of /8../32 prefixes, roughly
+// the shape of a host with a few VPNs and a lot of pushed routes
+static vec<Route_Entry> make_synthetic_routes(const vec<shared<Interface>>& interfaces,
+                                              u32 count)
+{
+    std::mt19937 rng(count);
+    vec<Route_Entry> routes;
+    routes.reserve(count + 1);
+
+    routes.push_back({{0, 0}, 0, interfaces.front()->luid.Value}); // default route
+
+    for (u32 i = 0; i < count; ++i)
+    {
+        u8 length = static_cast<u8>(8 + rng() % 25);
+        u32 address = rng() & (~0u << (32 - length));
+        routes.push_back({{address, length}, rng() % 256,
+                          interfaces[i % interfaces.size()]->luid.Value});
+    }
+
+    return routes;
+}
+
+template<typename Fn>
+void run_stage(Json_Writer& json, const char* stage, u32 size, u32 reps, Fn&& fn)
+{
+    i64 min_ns = std::numeric_limits<i64>::max();
+    i64 total_ns = 0;
+
+    for (u32 r = 0; r < reps; ++r)
+    {
+        auto start = Clock::now();
+        fn();
+        auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            Clock::now() - start).count();
+
+        min_ns = std::min(min_ns, elapsed);
+        total_ns += elapsed;
+    }
+
+    json.StartObject();
+    json.Key("stage"); json.String(stage);
+    json.Key("interfaces"); json.Uint(size);
+    json.Key("reps"); json.Uint(reps);
+    json.Key("min_ns"); json.Int64(min_ns);
+    json.Key("mean_ns"); json.Int64(total_ns / reps);
+    json.Key("ns_per_interface"); json.Double(double(min_ns) / size);
+    json.EndObject();
+}
+
+void bench_size(Json_Writer& json, u32 size)
+{
+    u32 reps = std::clamp<u32>(200'000 / size, 2, 100);
+
+    auto set = make_synthetic_adapters(size);
+    auto interfaces = parse_synthetic_adapters(set);
+    auto nic_list = make_reversed_nic_list(interfaces);
+
+    run_stage(json, "collect_parse", size, reps, [&]()
+    {
+        sink = sink + parse_synthetic_adapters(set).size();
+    });
+
+    run_stage(json, "update_match_plan", size, reps, [&]()
+    {
+        sink = sink + plan_nic_metric(interfaces, nic_list).writes.size();
+    });
+
+    // NOTE: the same list the way somebody might type it
+    str sloppy_list;
+    sloppy_list.reserve(nic_list.size() * 2);
+
+    for (char c : nic_list)
+    {
+        if (c == ' ')
+            sloppy_list.append("  ");
+        else
+            sloppy_list.push_back((c >= 'A' and c <= 'Z') ? char(c - 'A' + 'a') : c);
+    }
+
+    run_stage(json, "loose_match_plan", size, reps, [&]()
+    {
+        sink = sink + plan_nic_metric(interfaces, sloppy_list, Name_Match::loose).writes.size();
+    });
+
+    auto rule_list = make_rule_list();
+
+    run_stage(json, "rules_match_plan", size, reps, [&]()
+    {
+        sink = sink + plan_nic_metric(interfaces, rule_list).writes.size();
+    });
+
+    Metric_Plan plan;
+
+    run_stage(json, "replan_with_cost", size, reps, [&]()
+    {
+        // what the gui does after every drag
+        plan_nic_metric(interfaces, plan);
+        sink = sink + estimate_plan_cost(plan).writes;
+    });
+
+    run_stage(json, "model_build", size, reps, [&]()
+    {
+        Interface_Model model;
+        model.setInterfaces(interfaces);
+
+        // NOTE: a view only ever asks for the rows on screen
+        int visible = std::min(model.rowCount(), 50);
+        for (int row = 0; row < visible; ++row)
+            sink = sink + model.data(model.index(row, 0)).toString().size();
+    });
+
+    Name_Index index;
+
+    run_stage(json, "filter_index_build", size, reps, [&]()
+    {
+        index.build(interfaces);
+        sink = sink + index.size();
+    });
+
+    run_stage(json, "filter_keystrokes", size, reps, [&]()
+    {
+        // someone typing "ethernet 1", one query per keystroke
+        str typed;
+        for (char c : string_view("ethernet 1"))
+        {
+            typed.push_back(c);
+            sink = sink + index.query(typed);
+        }
+        sink = sink + index.query("");
+    });
+
+    Name_Suggester suggester;
+
+    run_stage(json, "suggest_build", size, std::min<u32>(reps, 10), [&]()
+    {
+        suggester.build(interfaces);
+        sink = sink + suggester.size();
+    });
+
+    run_stage(json, "suggest_typos", size, reps, [&]()
+    {
+        // ten misspelled lines, what a skipped apply looks up
+        for (u32 i = 0; i < 10; ++i)
+            sink = sink + suggester.suggest(std::format("Ethernt {}", i * 7919 % size)).size();
+    });
+
+    Interface_Model model;
+    model.setInterfaces(interfaces);
+
+    run_stage(json, "model_move", size, reps, [&]()
+    {
+        // first row to the bottom, what a drag across the whole list does
+        sink = sink + model.moveRows({}, 0, 1, {}, model.rowCount());
+    });
+
+    // NOTE: one route per interface, so the table grows with the size
+    auto routes = make_synthetic_routes(interfaces, size);
+    auto metrics = current_interface_metrics(interfaces);
+    Route_Table table;
+
+    run_stage(json, "route_build", size, std::min<u32>(reps, 10), [&]()
+    {
+        sink = sink + table.build(routes, metrics);
+    });
+
+    // a million random destinations, ns_per_interface is per 1M lookups
+    vec<u32> destinations(1'000'000);
+    vec<u64> egress(destinations.size());
+    std::mt19937 rng(size);
+    for (auto& destination : destinations)
+        destination = rng();
+
+    run_stage(json, "route_lookup_1m", size, std::min<u32>(reps, 10), [&]()
+    {
+        table.lookup(destinations, egress);
+        sink = sink + egress.back();
+    });
+}
+
+// NOTE: apply against the replay backend, every write costs replay_us.
+// Interfaces are a fixed 64, what matters is how the wall time falls
+// with the number of writes in flight
+void bench_parallel_apply(Json_Writer& json, const Bench_Options& options)
+{
+    constexpr u32 size = 64;
+
+    auto set = make_synthetic_adapters(size);
+    auto interfaces = parse_synthetic_adapters(set);
+    auto plan = plan_nic_metric(interfaces);
+
+    i64 serial_ns = 0;
+
+    for (u32 concurrency : {1u, 2u, 4u, 8u, 16u, 32u})
+    {
+        Replay_Backend backend({std::chrono::microseconds(options.replay_us)});
+        auto report = apply_nic_metric_plan(plan, backend, concurrency);
+        auto elapsed = static_cast<i64>(report.elapsed_ns);
+
+        if (concurrency == 1)
+            serial_ns = elapsed;
+
+        json.StartObject();
+        json.Key("stage"); json.String("parallel_apply");
+        json.Key("interfaces"); json.Uint(size);
+        json.Key("writes"); json.Uint64(backend.writes().size());
+        json.Key("replay_us"); json.Uint(options.replay_us);
+        json.Key("concurrency"); json.Uint(concurrency);
+        json.Key("elapsed_ns"); json.Int64(elapsed);
+        json.Key("speedup"); json.Double(double(serial_ns) / double(std::max<i64>(elapsed, 1)));
+        json.EndObject();
+    }
+}
+
+// NOTE: not a timing, a sanity check riding along. A name listed twice
+// puts its interface in the plan twice and the parallel apply has to end
+// where the serial one does; a mismatch shows in the json and on stderr
+void check_duplicate_apply(Json_Writer& json)
+{
+    constexpr u32 size = 16;
+
+    auto set = make_synthetic_adapters(size);
+    auto interfaces = parse_synthetic_adapters(set);
+
+    str nic_list;
+    for (u32 i = 0; i < size; ++i)
+        nic_list.append(interfaces[i]->name).append("\n");
+    nic_list.append(interfaces[0]->name).append("\n");
+    nic_list.append(interfaces[1]->name).append("\n");
+
+    auto plan = plan_nic_metric(interfaces, nic_list);
+
+    std::unordered_map<u64, u32> serial;
+    for (const auto& write : plan.writes)
+        serial[get_luid(write.nic)] = write.new_metric;
+
+    Replay_Backend backend({std::chrono::microseconds(200), std::chrono::microseconds(50)});
+    apply_nic_metric_plan(plan, backend, 8);
+
+    std::unordered_map<u64, u32> parallel;
+    for (const auto& write : backend.writes())
+        parallel[write.luid] = write.new_metric;
+
+    bool same = parallel == serial;
+
+    json.StartObject();
+    json.Key("stage"); json.String("parallel_apply_duplicates");
+    json.Key("interfaces"); json.Uint(size);
+    json.Key("plan_writes"); json.Uint64(plan.writes.size());
+    json.Key("matches_serial"); json.Bool(same);
+    json.EndObject();
+
+    if (not same)
+        std::println(stderr, "[ERROR] parallel apply of a duplicate line differs from serial");
+}
+
+bool parse_options(int argc, char* argv[], Bench_Options& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        string_view arg = argv[i];
+        bool has_value = i + 1 < argc;
+
+        if (arg == "--sizes" and has_value)
+        {
+            options.sizes.clear();
+            std::istringstream stream(argv[++i]);
+            str size;
+            while (std::getline(stream, size, ','))
+                options.sizes.push_back(std::stoul(size));
+        }
+        else if (arg == "--replay-us" and has_value)
+        {
+            options.replay_us = std::stoul(argv[++i]);
+        }
+        else if (arg == "--out" and has_value)
+        {
+            options.out_path = argv[++i];
+        }
+        else
+        {
+            std::println(stderr, "usage: qtnic_bench [--sizes 10,100,...] "
+                                 "[--replay-us N] [--out file.json]");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    Bench_Options options;
+
+    if (not parse_options(argc, argv, options))
+        return 1;
+
+    rapidjson::StringBuffer buffer;
+    Json_Writer json(buffer);
+
+    json.StartObject();
+    json.Key("schema"); json.String("qtnic-bench/1");
+    json.Key("results");
+    json.StartArray();
+
+    for (u32 size : options.sizes)
+    {
+        if (size > 0)
+            bench_size(json, size);
+    }
+
+    bench_parallel_apply(json, options);
+    check_duplicate_apply(json);
+
+    json.EndArray();
+    json.EndObject();
+
+    if (options.out_path.empty())
+    {
+        std::println("{}", buffer.GetString());
+        return 0;
+    }
+
+    FILE* out = std::fopen(options.out_path.c_str(), "wb");
+
+    if (not out)
+    {
+        std::println(stderr, "[ERROR] cannot open '{}'", options.out_path);
+        return 1;
+    }
+
+    std::fwrite(buffer.GetString(), 1, buffer.GetSize(), out);
+    std::fclose(out);
+
+    return 0;
+}
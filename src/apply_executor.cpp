@@ -0,0 +1,171 @@
+#include "apply_executor.h"
+
+#include "metrics.h"
+#include "nic_private.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <unordered_map>
+
+Nic_Result<void> Kernel_Backend::write(const shared<Interface>& nic,
+                                       u16 family,
+                                       u32 new_metric,
+                                       bool disable_automatic)
+{
+    Compartment_Scope scope(nic->compartment);
+
+    if (scope.res != NO_ERROR)
+    {
+        return std::unexpected(Nic_Error {
+            .code = Nic_Errc::enter_compartment,
+            .os_error = scope.res,
+            .compartment = nic->compartment,
+            .nic = nic});
+    }
+
+    return update_nic_metric_for_luid(nic, family, new_metric, disable_automatic);
+}
+
+Replay_Backend::Replay_Backend(vec<std::chrono::nanoseconds> latencies)
+    : latencies(std::move(latencies))
+{
+}
+
+Nic_Result<void> Replay_Backend::write(const shared<Interface>& nic,
+                                       u16 family,
+                                       u32 new_metric,
+                                       bool disable_automatic)
+{
+    (void)disable_automatic;
+
+    std::chrono::nanoseconds latency {0};
+
+    {
+        std::scoped_lock lock(mutex);
+
+        if (not latencies.empty())
+            latency = latencies[next++ % latencies.size()];
+
+        recorded.push_back({nic->luid.Value, family, new_metric});
+    }
+
+    std::this_thread::sleep_for(latency);
+    return {};
+}
+
+vec<Replay_Backend::Write> Replay_Backend::writes() const
+{
+    std::scoped_lock lock(mutex);
+    return recorded;
+}
+
+std::optional<Nic_Error> Apply_Report::first_error() const
+{
+    for (const auto& write : writes)
+    {
+        if (write.error)
+            return write.error;
+    }
+
+    return std::nullopt;
+}
+
+Apply_Report apply_nic_metric_plan(const Metric_Plan& plan,
+                                   Metric_Backend& backend,
+                                   u32 concurrency)
+{
+    QTNIC_TRACE_SCOPE("apply_nic_metric_plan (parallel)");
+    Op_Timer timer(Nic_Op::apply);
+
+    using Clock = std::chrono::steady_clock;
+    auto started = Clock::now();
+
+    const size_t count = plan.writes.size();
+
+    Apply_Report report {};
+    report.writes.resize(count);
+
+    // NOTE: a name listed twice (or twice the same key with --loose) puts
+    // one interface in the plan more than once. All of its writes go to
+    // the same worker in plan order, so they never overlap and the last
+    // one wins like in the serial apply
+    vec<vec<u32>> jobs;
+    jobs.reserve(count);
+
+    {
+        std::unordered_map<const Interface*, u32> job_of;
+        job_of.reserve(count);
+
+        for (u32 i = 0; i < count; ++i)
+        {
+            auto [it, inserted] = job_of.try_emplace(plan.writes[i].nic.get(), u32(jobs.size()));
+
+            if (inserted)
+                jobs.emplace_back();
+
+            jobs[it->second].push_back(i);
+        }
+    }
+
+    std::atomic<size_t> next {0};
+
+    auto run_write = [&](u32 i)
+    {
+        const auto& write = plan.writes[i];
+        auto& timing = report.writes[i];
+        timing.nic = write.nic;
+
+        auto write_started = Clock::now();
+
+        auto write_family = [&](u16 family, bool automatic_metric)
+        {
+            if (timing.error)
+                return;
+
+            auto res = backend.write(write.nic, family, write.new_metric, automatic_metric);
+
+            if (not res)
+                timing.error = res.error();
+        };
+
+        if (write.nic->ipv4_enabled)
+            write_family(AF_INET, write.nic->automatic_metric);
+
+        if (write.nic->ipv6_enabled)
+            write_family(AF_INET6, write.nic->automatic_metric_v6);
+
+        timing.latency_ns = static_cast<u64>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - write_started).count());
+    };
+
+    auto worker = [&]()
+    {
+        for (size_t job = next++; job < jobs.size(); job = next++)
+        {
+            for (u32 i : jobs[job])
+                run_write(i);
+        }
+    };
+
+    {
+        size_t worker_count = std::clamp<size_t>(concurrency, 1, std::max<size_t>(jobs.size(), 1));
+
+        vec<std::jthread> pool;
+        pool.reserve(worker_count - 1);
+
+        for (size_t i = 1; i < worker_count; ++i)
+            pool.emplace_back(worker);
+
+        worker();
+    }
+
+    report.elapsed_ns = static_cast<u64>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - started).count());
+
+    if (report.first_error())
+        timer.fail();
+
+    return report;
+}
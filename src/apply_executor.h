@@ -0,0 +1,86 @@
+#ifndef APPLY_EXECUTOR_H
+#define APPLY_EXECUTOR_H
+
+#include <chrono>
+#include <mutex>
+
+#include "nic.h"
+
+// NOTE: where metric writes end up. One call per interface and family,
+// the caller guarantees that calls for the same interface never overlap
+class Metric_Backend
+{
+public:
+    virtual ~Metric_Backend() = default;
+
+    virtual Nic_Result<void> write(const shared<Interface>& nic,
+                                   u16 family,
+                                   u32 new_metric,
+                                   bool disable_automatic) = 0;
+};
+
+// NOTE: the real thing, SetIpInterfaceEntry in the interface's compartment
+class Kernel_Backend : public Metric_Backend
+{
+public:
+    Nic_Result<void> write(const shared<Interface>& nic,
+                           u16 family,
+                           u32 new_metric,
+                           bool disable_automatic) override;
+};
+
+// NOTE: touches nothing, every write just takes the next of the recorded
+// latencies (round robin) and is remembered, so apply strategies can be
+// measured and checked anywhere
+class Replay_Backend : public Metric_Backend
+{
+public:
+    struct Write
+    {
+        u64 luid {0};
+        u16 family {0};
+        u32 new_metric {0};
+    };
+
+    explicit Replay_Backend(vec<std::chrono::nanoseconds> latencies);
+
+    Nic_Result<void> write(const shared<Interface>& nic,
+                           u16 family,
+                           u32 new_metric,
+                           bool disable_automatic) override;
+
+    vec<Write> writes() const;
+
+private:
+    vec<std::chrono::nanoseconds> latencies;
+    mutable std::mutex mutex;
+    size_t next {0};
+    vec<Write> recorded;
+};
+
+struct Write_Timing
+{
+    shared<Interface> nic;
+    u64 latency_ns {0}; // both families of the interface
+    std::optional<Nic_Error> error;
+};
+
+struct Apply_Report
+{
+    vec<Write_Timing> writes; // same order as the plan
+    u64 elapsed_ns {0};
+
+    std::optional<Nic_Error> first_error() const;
+};
+
+// NOTE: interfaces are independent, every one gets an absolute metric, so
+// they can be written in any order and the end result is the same as the
+// serial apply_nic_metric_plan(). At most `concurrency` writes are in
+// flight. Every write of an interface, both families and every time the
+// plan lists it, goes out from the same worker in plan order. A failed
+// interface does not stop the others
+Apply_Report apply_nic_metric_plan(const Metric_Plan& plan,
+                                   Metric_Backend& backend,
+                                   u32 concurrency);
+
+#endif // APPLY_EXECUTOR_H
@@ -0,0 +1,85 @@
+#include "change_coalescer.h"
+
+Change_Coalescer::Change_Coalescer(QObject *parent)
+    : QObject(parent)
+    , timer(new QTimer(this))
+{
+    timer->setSingleShot(true);
+    timer->setInterval(frame_ms);
+
+    connect(timer, &QTimer::timeout,
+            this, &Change_Coalescer::flush);
+}
+
+void Change_Coalescer::push(const Nic_Change &change)
+{
+    ++received;
+
+    bool open_frame = false;
+
+    {
+        std::lock_guard lock(mutex);
+
+        auto [it, inserted] = pending.try_emplace({change.luid, change.family}, change);
+
+        if (not inserted)
+        {
+            // NOTE: a plain parameter change must not hide that the
+            // interface came or went in the same frame
+            auto kind = it->second.kind;
+            it->second = change;
+
+            if (change.kind == Nic_Change_Kind::changed)
+                it->second.kind = kind;
+
+            // only a change folded into one already pending saves work
+            ++coalesced;
+        }
+
+        if (not scheduled)
+            open_frame = scheduled = true;
+    }
+
+    // the timer lives in the gui thread, only poke it once per frame
+    if (open_frame)
+    {
+        QMetaObject::invokeMethod(timer, qOverload<>(&QTimer::start),
+                                  Qt::QueuedConnection);
+    }
+}
+
+u64 Change_Coalescer::receivedEvents() const
+{
+    return received;
+}
+
+u64 Change_Coalescer::coalescedEvents() const
+{
+    return coalesced;
+}
+
+u64 Change_Coalescer::flushes() const
+{
+    return flushed;
+}
+
+void Change_Coalescer::flush()
+{
+    vec<Nic_Change> changes;
+
+    {
+        std::lock_guard lock(mutex);
+
+        changes.reserve(pending.size());
+        for (const auto& [key, change] : pending)
+            changes.push_back(change);
+
+        pending.clear();
+        scheduled = false;
+    }
+
+    ++flushed;
+
+    if (not changes.empty())
+        emit changesReady(changes);
+}
@@ -0,0 +1,50 @@
+#ifndef CHANGE_COALESCER_H
+#define CHANGE_COALESCER_H
+
+#include <QObject>
+#include <QTimer>
+
+#include <atomic>
+#include <map>
+#include <mutex>
+
+#include "nic.h"
+
+// NOTE: sits between the kernel notifications and the model. Deltas
+// arriving within one frame are folded together (the last one for an
+// interface/family wins) and handed out in a single batch, so a link
+// storm costs at most one model update per frame.
+class Change_Coalescer : public QObject
+{
+    Q_OBJECT
+
+public:
+    explicit Change_Coalescer(QObject *parent = nullptr);
+
+    // NOTE: thread safe, called from the notification thread
+    void push(const Nic_Change &change);
+
+    u64 receivedEvents() const;
+    u64 coalescedEvents() const;
+    u64 flushes() const;
+
+signals:
+    void changesReady(const vec<Nic_Change> &changes);
+
+private:
+    void flush();
+
+    static constexpr int frame_ms = 16;
+
+    QTimer *timer;
+
+    std::mutex mutex;
+    std::map<std::pair<u64, u16>, Nic_Change> pending; // luid, family
+    bool scheduled {false};
+
+    std::atomic<u64> received {0};
+    std::atomic<u64> coalesced {0};
+    std::atomic<u64> flushed {0};
+};
+
+#endif // CHANGE_COALESCER_H
@@ -0,0 +1,255 @@
+#include "gateway_prober.h"
+
+#include "nic_private.h"
+#include "trace.h"
+
+#include <icmpapi.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <sstream>
+
+struct Icmp_Handle
+{
+    ~Icmp_Handle()
+    {
+        if (handle != INVALID_HANDLE_VALUE)
+            IcmpCloseHandle(handle);
+    }
+
+    HANDLE handle {INVALID_HANDLE_VALUE};
+};
+
+struct Event_Handle
+{
+    ~Event_Handle()
+    {
+        if (handle)
+            CloseHandle(handle);
+    }
+
+    HANDLE handle {NULL};
+};
+
+// NOTE: addresses are kept as space separated strings, both families mixed
+static std::optional<IN_ADDR> first_ipv4(str_cref addresses)
+{
+    std::istringstream stream(addresses);
+    str address;
+
+    while (stream >> address)
+    {
+        IN_ADDR parsed {};
+
+        if (inet_pton(AF_INET, address.c_str(), &parsed) == 1)
+            return parsed;
+    }
+
+    return std::nullopt;
+}
+
+Nic_Result<vec<Gateway_Probe>> probe_gateways(const vec<shared<Interface>>& interfaces,
+                                              u32 timeout_ms)
+{
+    QTNIC_TRACE_SCOPE("probe_gateways");
+
+    using Clock = std::chrono::steady_clock;
+
+    constexpr WORD payload_size = 32;
+
+    // NOTE: the reply, the echoed payload, 8 bytes for an icmp error and
+    // room for the IO_STATUS_BLOCK the async completion writes
+    constexpr DWORD reply_size = sizeof(ICMP_ECHO_REPLY) + payload_size + 8 + 64;
+
+    struct Pending
+    {
+        size_t probe;
+        Event_Handle event;
+        Clock::time_point sent;
+        std::array<u8, reply_size> reply;
+    };
+
+    vec<Gateway_Probe> probes;
+    probes.reserve(interfaces.size());
+
+    for (const auto& nic : interfaces)
+        probes.push_back({nic});
+
+    vec<std::pair<IN_ADDR, IN_ADDR>> targets; // source, gateway
+    vec<size_t> to_send;
+
+    for (size_t i = 0; i < interfaces.size(); ++i)
+    {
+        auto source = first_ipv4(interfaces[i]->ip);
+        auto gateway = first_ipv4(interfaces[i]->gateway);
+
+        if (not source or not gateway or not interfaces[i]->connected)
+        {
+            targets.push_back({});
+            continue;
+        }
+
+        char text[INET_ADDRSTRLEN] {};
+        inet_ntop(AF_INET, &*gateway, text, sizeof(text));
+        probes[i].gateway = text;
+
+        targets.push_back({*source, *gateway});
+        to_send.push_back(i);
+    }
+
+    char payload[payload_size] {};
+    std::fill(std::begin(payload), std::end(payload), 'q');
+
+    for (size_t first = 0; first < to_send.size(); first += MAXIMUM_WAIT_OBJECTS)
+    {
+        size_t count = std::min<size_t>(MAXIMUM_WAIT_OBJECTS, to_send.size() - first);
+
+        // NOTE: declared before the icmp handle, so that closing it (which
+        // cancels whatever is still out) happens before the buffers go
+        vec<Pending> pending(count);
+        Icmp_Handle icmp;
+        icmp.handle = IcmpCreateFile();
+
+        if (icmp.handle == INVALID_HANDLE_VALUE)
+            return std::unexpected(Nic_Error {Nic_Errc::icmp, GetLastError()});
+
+        vec<HANDLE> events;
+        vec<size_t> slots;
+
+        for (size_t i = 0; i < count; ++i)
+        {
+            auto& request = pending[i];
+            request.probe = to_send[first + i];
+            request.event.handle = CreateEventW(NULL, FALSE, FALSE, NULL);
+
+            if (not request.event.handle)
+                return std::unexpected(Nic_Error {Nic_Errc::icmp, GetLastError()});
+
+            const auto& [source, gateway] = targets[request.probe];
+            request.sent = Clock::now();
+
+            DWORD result = IcmpSendEcho2Ex(icmp.handle,
+                                           request.event.handle,
+                                           NULL,
+                                           NULL,
+                                           source.S_un.S_addr,
+                                           gateway.S_un.S_addr,
+                                           payload,
+                                           payload_size,
+                                           NULL,
+                                           request.reply.data(),
+                                           reply_size,
+                                           timeout_ms);
+
+            DWORD error = result == 0 ? GetLastError() : ERROR_IO_PENDING;
+
+            if (error != ERROR_IO_PENDING)
+            {
+                probes[request.probe].status = error;
+                continue;
+            }
+
+            events.push_back(request.event.handle);
+            slots.push_back(i);
+        }
+
+        // NOTE: one wait for the whole batch, whichever answers first is
+        // handled first and dropped from the set
+        auto deadline = Clock::now() + std::chrono::milliseconds(timeout_ms + 500);
+
+        while (not events.empty())
+        {
+            auto left = std::chrono::duration_cast<std::chrono::milliseconds>(
+                deadline - Clock::now()).count();
+
+            DWORD wait = WaitForMultipleObjects(static_cast<DWORD>(events.size()),
+                                                events.data(),
+                                                FALSE,
+                                                static_cast<DWORD>(std::max<i64>(left, 0)));
+
+            if (wait < WAIT_OBJECT_0 or wait >= WAIT_OBJECT_0 + events.size())
+                break;
+
+            // NOTE: every reply already in is stamped before any of them
+            // is parsed, so a reply does not carry the time spent on the
+            // ones ahead of it. The wait reports the lowest signaled index,
+            // the events are auto reset and are handled right here
+            auto received = Clock::now();
+            vec<size_t> ready {wait - WAIT_OBJECT_0};
+
+            for (size_t i = ready.front() + 1; i < events.size(); ++i)
+            {
+                if (WaitForSingleObject(events[i], 0) == WAIT_OBJECT_0)
+                    ready.push_back(i);
+            }
+
+            // highest first, so erasing keeps the other indices valid
+            for (auto it = ready.rbegin(); it != ready.rend(); ++it)
+            {
+                size_t signaled = *it;
+                auto& request = pending[slots[signaled]];
+                auto& probe = probes[request.probe];
+                auto elapsed = received - request.sent;
+
+                if (IcmpParseReplies(request.reply.data(), reply_size) > 0)
+                {
+                    auto* reply = reinterpret_cast<const ICMP_ECHO_REPLY*>(request.reply.data());
+                    probe.status = reply->Status;
+
+                    if (reply->Status == IP_SUCCESS)
+                    {
+                        probe.rtt_us = static_cast<u64>(
+                            std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count());
+                    }
+                }
+                else
+                {
+                    probe.status = GetLastError();
+                }
+
+                events.erase(events.begin() + signaled);
+                slots.erase(slots.begin() + signaled);
+            }
+        }
+
+        for (size_t slot : slots)
+            probes[pending[slot].probe].status = IP_REQ_TIMED_OUT;
+    }
+
+    return probes;
+}
+
+vec<shared<Interface>> order_by_gateway_latency(const vec<Gateway_Probe>& probes)
+{
+    vec<const Gateway_Probe*> sorted;
+    sorted.reserve(probes.size());
+
+    for (const auto& probe : probes)
+        sorted.push_back(&probe);
+
+    // NOTE: the probes come in enumeration order, the ones that did not
+    // answer have to keep the order their metrics already give them
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [](const Gateway_Probe* a, const Gateway_Probe* b)
+                     {
+                         return effective_metric(a->nic) < effective_metric(b->nic);
+                     });
+
+    std::stable_sort(sorted.begin(), sorted.end(),
+                     [](const Gateway_Probe* a, const Gateway_Probe* b)
+                     {
+                         if (a->rtt_us and b->rtt_us)
+                             return *a->rtt_us < *b->rtt_us;
+
+                         return a->rtt_us.has_value() and not b->rtt_us.has_value();
+                     });
+
+    vec<shared<Interface>> ordered;
+    ordered.reserve(sorted.size());
+
+    for (const auto* probe : sorted)
+        ordered.push_back(probe->nic);
+
+    return ordered;
+}
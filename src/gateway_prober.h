@@ -0,0 +1,26 @@
+#ifndef GATEWAY_PROBER_H
+#define GATEWAY_PROBER_H
+
+#include "nic.h"
+
+struct Gateway_Probe
+{
+    shared<Interface> nic;
+    str gateway;               // the IPv4 gateway that was pinged, empty if none
+    std::optional<u64> rtt_us; // nullopt if it did not answer
+    u32 status {0};            // IP_STATUS of the reply or the win32 error
+};
+
+// NOTE: one ICMP echo to the first IPv4 gateway of every interface, sent
+// from that interface's own address so it cannot leave through another
+// one. All the echoes of a batch are in flight together and completed
+// from a single wait loop, a batch being as many as one wait can watch (64)
+Nic_Result<vec<Gateway_Probe>> probe_gateways(const vec<shared<Interface>>& interfaces,
+                                              u32 timeout_ms = 1000);
+
+// NOTE: the "order by measured latency" policy: interfaces whose gateway
+// answered first, fastest on top, the others after them in their
+// current metric order (see effective_metric())
+vec<shared<Interface>> order_by_gateway_latency(const vec<Gateway_Probe>& probes);
+
+#endif // GATEWAY_PROBER_H
@@ -0,0 +1,43 @@
+#include "interface_filter_model.h"
+
+#include "interface_model.h"
+
+Interface_Filter_Model::Interface_Filter_Model(Interface_Model *source, QObject *parent)
+    : QSortFilterProxyModel(parent)
+    , source(source)
+{
+    // NOTE: the filter only reads the Name_Index, so a dataChanged (the
+    // Traffic column every second) can never change its answer. Rows
+    // that come in are still filtered, and setFilterText() invalidates
+    setDynamicSortFilter(false);
+    setSourceModel(source);
+}
+
+void Interface_Filter_Model::setFilterText(const QString &text)
+{
+    filter_text = text.toStdString();
+
+    if (index.size() != source->interfaces().size())
+        index.build(source->interfaces());
+
+    index.query(filter_text);
+    invalidateFilter();
+}
+
+bool Interface_Filter_Model::filterAcceptsRow(int source_row, const QModelIndex &source_parent) const
+{
+    if (source_parent.isValid())
+        return false;
+
+    if (filter_text.empty())
+        return true;
+
+    u64 luid = get_luid(source->interfaces()[source_row]);
+
+    // NOTE: rows are appended in chunks while the list streams in, the
+    // first unknown one brings in the rest of its chunk after it
+    if (not index.contains(luid))
+        index.add(source->interfaces(), static_cast<size_t>(source_row));
+
+    return index.matches(luid);
+}
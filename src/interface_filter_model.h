@@ -0,0 +1,34 @@
+#ifndef INTERFACE_FILTER_MODEL_H
+#define INTERFACE_FILTER_MODEL_H
+
+#include <QSortFilterProxyModel>
+
+#include "name_index.h"
+
+class Interface_Model;
+
+// NOTE: narrows the interface list to the rows whose name or description
+// contains the filter text, answered by a prebuilt Name_Index
+class Interface_Filter_Model : public QSortFilterProxyModel
+{
+    Q_OBJECT
+
+public:
+    explicit Interface_Filter_Model(Interface_Model *source, QObject *parent = nullptr);
+
+public slots:
+    void setFilterText(const QString &text);
+
+protected:
+    bool filterAcceptsRow(int source_row, const QModelIndex &source_parent) const override;
+
+private:
+    Interface_Model *source;
+    str filter_text;
+
+    // NOTE: grows lazily the first time a row it does not know shows up,
+    // rebuilt when the filter changes and the rows no longer add up
+    mutable Name_Index index;
+};
+
+#endif // INTERFACE_FILTER_MODEL_H
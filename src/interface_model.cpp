@@ -0,0 +1,516 @@
+#include "interface_model.h"
+#include "traffic_sampler.h"
+
+#include <QDataStream>
+#include <QIODevice>
+#include <QLocale>
+#include <QMimeData>
+
+#include <algorithm>
+#include <array>
+#include <unordered_map>
+
+// NOTE: drags never leave the view, all we need to carry are the rows
+static const QString rows_mime_type = QStringLiteral("application/x-qtnic-rows");
+
+Interface_Model::Interface_Model(QObject *parent)
+    : QAbstractTableModel(parent)
+    , cells(max_cached_cells)
+{
+}
+
+void Interface_Model::setInterfaces(vec<shared<Interface>> interfaces)
+{
+    beginResetModel();
+    nics = std::move(interfaces);
+    cells.clear();
+    endResetModel();
+}
+
+void Interface_Model::appendInterfaces(vec<shared<Interface>> interfaces)
+{
+    if (interfaces.empty())
+        return;
+
+    int first = rowCount();
+    beginInsertRows({}, first, first + static_cast<int>(interfaces.size()) - 1);
+    nics.insert(nics.end(),
+                std::make_move_iterator(interfaces.begin()),
+                std::make_move_iterator(interfaces.end()));
+    endInsertRows();
+}
+
+const vec<shared<Interface>>& Interface_Model::interfaces() const
+{
+    return nics;
+}
+
+bool Interface_Model::applyChanges(const vec<Nic_Change> &changes)
+{
+    std::unordered_map<u64, int> row_of;
+    row_of.reserve(nics.size());
+
+    for (int row = 0; row < rowCount(); ++row)
+        row_of.emplace(get_luid(nics[row]), row);
+
+    bool topology_changed = false;
+    int first_changed = rowCount();
+    int last_changed = -1;
+
+    for (const auto& change : changes)
+    {
+        if (change.kind != Nic_Change_Kind::changed)
+        {
+            topology_changed = true;
+            continue;
+        }
+
+        auto it = row_of.find(change.luid);
+
+        if (it == row_of.end())
+            continue;
+
+        int row = it->second;
+        nics[row] = apply_nic_change(nics[row], change);
+        forgetCells(nics[row]);
+
+        first_changed = std::min(first_changed, row);
+        last_changed = std::max(last_changed, row);
+    }
+
+    if (last_changed >= 0)
+        emit dataChanged(index(first_changed, 0), index(last_changed, Column_Count - 1));
+
+    return topology_changed;
+}
+
+void Interface_Model::mergeInterfaces(vec<shared<Interface>> fresh)
+{
+    std::unordered_map<u64, shared<Interface>> by_luid;
+    by_luid.reserve(fresh.size());
+
+    for (const auto& nic : fresh)
+        by_luid.emplace(get_luid(nic), nic);
+
+    vec<int> gone;
+    int first_changed = rowCount();
+    int last_changed = -1;
+
+    for (int row = 0; row < rowCount(); ++row)
+    {
+        auto it = by_luid.find(get_luid(nics[row]));
+
+        if (it == by_luid.end())
+        {
+            gone.push_back(row);
+            continue;
+        }
+
+        nics[row] = std::move(it->second);
+        by_luid.erase(it);
+        forgetCells(nics[row]);
+
+        first_changed = std::min(first_changed, row);
+        last_changed = std::max(last_changed, row);
+    }
+
+    if (last_changed >= 0)
+        emit dataChanged(index(first_changed, 0), index(last_changed, Column_Count - 1));
+
+    std::reverse(gone.begin(), gone.end());
+    removeRowsDescending(gone);
+
+    // whatever is left in the map is new, appended in enumeration order
+    vec<shared<Interface>> added;
+
+    for (auto& nic : fresh)
+    {
+        if (by_luid.contains(get_luid(nic)))
+            added.push_back(std::move(nic));
+    }
+
+    appendInterfaces(std::move(added));
+}
+
+void Interface_Model::setTrafficSampler(const Traffic_Sampler *sampler)
+{
+    traffic = sampler;
+    trafficUpdated();
+}
+
+void Interface_Model::trafficUpdated()
+{
+    // NOTE: only the rows whose shown rate moved are repainted, in
+    // contiguous runs, an idle interface costs nothing per sample
+    std::unordered_map<u64, Shown_Rate> next;
+    next.reserve(nics.size());
+
+    int first = -1;
+
+    auto flush = [this, &first](int last)
+    {
+        if (first < 0)
+            return;
+
+        emit dataChanged(index(first, Traffic), index(last, Traffic), {Qt::DisplayRole});
+        first = -1;
+    };
+
+    for (int row = 0; row < rowCount(); ++row)
+    {
+        u64 luid = get_luid(nics[row]);
+        auto rate = traffic ? traffic->latest(luid) : std::nullopt;
+
+        Shown_Rate shown {-1, -1};
+        if (rate)
+            shown = {qint64(rate->rx_bytes), qint64(rate->tx_bytes)};
+
+        next[luid] = shown;
+
+        auto it = shown_rates.find(luid);
+
+        if (it != shown_rates.end() and it->second == shown)
+        {
+            flush(row - 1);
+            continue;
+        }
+
+        cells.remove({luid, Traffic});
+
+        if (first < 0)
+            first = row;
+    }
+
+    flush(rowCount() - 1);
+    shown_rates = std::move(next);
+}
+
+QString Interface_Model::trafficToolTip(const shared<Interface> &nic) const
+{
+    // NOTE: only built while the mouse rests on the cell, the ring is
+    // not worth walking on every sample
+    std::array<Traffic_Rate, Traffic_Sampler::history_size> rates;
+    size_t count = traffic ? traffic->history(get_luid(nic), rates) : 0;
+
+    if (count == 0)
+        return {};
+
+    float rx = 0;
+    float tx = 0;
+
+    for (size_t i = 0; i < count; ++i)
+    {
+        rx = std::max(rx, rates[i].rx_bytes);
+        tx = std::max(tx, rates[i].tx_bytes);
+    }
+
+    QLocale locale;
+    return QString("peak over the last %1 s: %2/s / %3/s")
+        .arg(count)
+        .arg(locale.formattedDataSize(qint64(rx)))
+        .arg(locale.formattedDataSize(qint64(tx)));
+}
+
+void Interface_Model::removeRowsDescending(const vec<int> &rows)
+{
+    // NOTE: contiguous runs go out in one beginRemoveRows each
+    size_t i = 0;
+
+    while (i < rows.size())
+    {
+        int last = rows[i];
+        int first = last;
+
+        while (i + 1 < rows.size() and rows[i + 1] == first - 1)
+        {
+            first = rows[++i];
+        }
+
+        beginRemoveRows({}, first, last);
+        nics.erase(nics.begin() + first, nics.begin() + last + 1);
+        endRemoveRows();
+
+        ++i;
+    }
+}
+
+int Interface_Model::rowCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+
+    return static_cast<int>(nics.size());
+}
+
+int Interface_Model::columnCount(const QModelIndex &parent) const
+{
+    if (parent.isValid())
+        return 0;
+
+    return Column_Count;
+}
+
+QVariant Interface_Model::data(const QModelIndex &index, int role) const
+{
+    // NOTE: only called for the cells the view is actually painting
+    if (not index.isValid() or index.row() >= rowCount())
+        return {};
+
+    const auto& nic = nics[index.row()];
+
+    switch (role)
+    {
+    case Qt::DisplayRole:
+    {
+        QPair<quint64, int> key {get_luid(nic), index.column()};
+
+        if (auto* cached = cells.object(key))
+            return *cached;
+
+        auto* cell = new QString(formatCell(nic, index.column()));
+        QString text = *cell;
+        cells.insert(key, cell);
+        return text;
+    }
+
+    case Qt::ToolTipRole:
+        if (index.column() == Traffic)
+            return trafficToolTip(nic);
+
+        return QString::fromUtf8(get_description(nic).data(), -1);
+    }
+
+    return {};
+}
+
+QVariant Interface_Model::headerData(int section, Qt::Orientation orientation, int role) const
+{
+    if (orientation != Qt::Horizontal or role != Qt::DisplayRole)
+        return QAbstractTableModel::headerData(section, orientation, role);
+
+    switch (section)
+    {
+    case Name: return "Name";
+    case Ip: return "IP";
+    case Subnet: return "Subnet";
+    case Gateway: return "Gateway";
+    case Dns: return "DNS";
+    case Dns_Suffix: return "DNS suffix";
+    case Metric: return "Metric (v4 / v6)";
+    case Automatic_Metric: return "Automatic";
+    case Connected: return "Status";
+    case Traffic: return "Rx / Tx";
+    }
+
+    return {};
+}
+
+QString Interface_Model::formatCell(const shared<Interface> &nic, int column) const
+{
+    auto text = [](str_cref s)
+    {
+        return QString::fromUtf8(s.data(), static_cast<qsizetype>(s.size())).trimmed();
+    };
+
+    switch (column)
+    {
+    case Name:
+        return text(get_name(nic));
+
+    case Ip:
+        return text(get_ip(nic));
+
+    case Subnet:
+        return get_subnet(nic) ? QString("/%1").arg(get_subnet(nic)) : QString();
+
+    case Gateway:
+        return text(get_gateway(nic));
+
+    case Dns:
+        return text(get_dns(nic));
+
+    case Dns_Suffix:
+        return text(get_dns_suffix(nic));
+
+    case Metric:
+    {
+        auto v4 = get_metric(nic);
+        auto v6 = get_metric_v6(nic);
+
+        if (v4 and v6)
+            return QString("%1 / %2").arg(*v4).arg(*v6);
+        if (v4)
+            return QString::number(*v4);
+        if (v6)
+            return QString("- / %1").arg(*v6);
+        return {};
+    }
+
+    case Automatic_Metric:
+        return is_automatic_metric(nic) ? "yes" : "no";
+
+    case Connected:
+        return is_connected(nic) ? "up" : "down";
+
+    case Traffic:
+    {
+        auto rate = traffic ? traffic->latest(get_luid(nic)) : std::nullopt;
+
+        if (not rate)
+            return {};
+
+        QLocale locale;
+        return QString("%1/s / %2/s")
+            .arg(locale.formattedDataSize(qint64(rate->rx_bytes)))
+            .arg(locale.formattedDataSize(qint64(rate->tx_bytes)));
+    }
+    }
+
+    return {};
+}
+
+void Interface_Model::forgetCells(const shared<Interface> &nic)
+{
+    quint64 luid = get_luid(nic);
+
+    for (int column = 0; column < Column_Count; ++column)
+        cells.remove({luid, column});
+}
+
+Qt::ItemFlags Interface_Model::flags(const QModelIndex &index) const
+{
+    auto default_flags = QAbstractTableModel::flags(index);
+
+    if (not index.isValid())
+        return default_flags | Qt::ItemIsDropEnabled;
+
+    // NOTE: no ItemIsDropEnabled on rows, drops go between them
+    return default_flags | Qt::ItemIsDragEnabled;
+}
+
+Qt::DropActions Interface_Model::supportedDropActions() const
+{
+    return Qt::MoveAction;
+}
+
+QStringList Interface_Model::mimeTypes() const
+{
+    return {rows_mime_type};
+}
+
+QMimeData* Interface_Model::mimeData(const QModelIndexList &indexes) const
+{
+    vec<int> rows;
+    rows.reserve(indexes.size());
+
+    for (const auto& index : indexes)
+    {
+        if (index.isValid())
+            rows.push_back(index.row());
+    }
+
+    if (rows.empty())
+        return nullptr;
+
+    // NOTE: a row selected in the details view comes in once per column
+    std::sort(rows.begin(), rows.end());
+    rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+
+    // every row, the view may well let more than one contiguous block go
+    QByteArray encoded;
+    QDataStream stream(&encoded, QIODevice::WriteOnly);
+    stream << static_cast<int>(rows.size());
+
+    for (int row : rows)
+        stream << row;
+
+    auto* mime_data = new QMimeData();
+    mime_data->setData(rows_mime_type, encoded);
+    return mime_data;
+}
+
+bool Interface_Model::dropMimeData(const QMimeData *data, Qt::DropAction action,
+                                   int row, int column, const QModelIndex &parent)
+{
+    Q_UNUSED(column);
+
+    if (action != Qt::MoveAction or not data->hasFormat(rows_mime_type))
+        return false;
+
+    QDataStream stream(data->data(rows_mime_type));
+
+    int count = 0;
+    stream >> count;
+
+    if (count <= 0 or count > rowCount())
+        return false;
+
+    vec<int> rows(count);
+
+    for (int& source_row : rows)
+    {
+        stream >> source_row;
+
+        if (stream.status() != QDataStream::Ok or source_row < 0 or source_row >= rowCount())
+            return false;
+    }
+
+    if (row < 0)
+        row = parent.isValid() ? parent.row() : rowCount();
+
+    // NOTE: ascending from mimeData(). The rows above the drop point go
+    // there last first, each landing just above the previous one, the
+    // rows below it first first, each just under the previous one, so the
+    // block comes out in its old order. Rows in between never shift the
+    // indices still to be moved
+    auto split = std::lower_bound(rows.begin(), rows.end(), row);
+    bool moved = false;
+
+    int target = row;
+    for (auto it = std::make_reverse_iterator(split); it != rows.rend(); ++it)
+        moved = moveRows({}, *it, 1, {}, target--) or moved;
+
+    target = row;
+    for (auto it = split; it != rows.end(); ++it)
+        moved = moveRows({}, *it, 1, {}, target++) or moved;
+
+    return moved;
+}
+
+bool Interface_Model::moveRows(const QModelIndex &sourceParent, int sourceRow, int count,
+                               const QModelIndex &destinationParent, int destinationChild)
+{
+    const int size = rowCount();
+
+    if (sourceParent.isValid() or destinationParent.isValid())
+        return false;
+
+    if (count <= 0 or sourceRow < 0 or sourceRow + count > size or
+        destinationChild < 0 or destinationChild > size)
+    {
+        return false;
+    }
+
+    // dropping a block onto itself is a no-op
+    if (destinationChild >= sourceRow and destinationChild <= sourceRow + count)
+        return false;
+
+    beginMoveRows({}, sourceRow, sourceRow + count - 1, {}, destinationChild);
+
+    // NOTE: a single rotate of the pointers in between, no Interface is
+    // copied and nothing gets re-matched by name. That is linear in the
+    // distance, but so is what beginMoveRows() does to the persistent
+    // indexes and the proxy's mapping; 50k pointers are a few microseconds
+    auto first = nics.begin() + sourceRow;
+    auto last = first + count;
+    auto destination = nics.begin() + destinationChild;
+
+    if (destinationChild < sourceRow)
+        std::rotate(destination, first, last);
+    else
+        std::rotate(first, last, destination);
+
+    endMoveRows();
+
+    return true;
+}
@@ -0,0 +1,89 @@
+#ifndef INTERFACE_MODEL_H
+#define INTERFACE_MODEL_H
+
+#include <QAbstractTableModel>
+#include <QCache>
+#include <QPair>
+
+#include <unordered_map>
+
+#include "nic.h"
+
+class Traffic_Sampler;
+
+// NOTE: the interface table in the order the user wants it, rows are
+// just shared pointers so moving them around never copies an Interface.
+// The list view shows column 0 only, the details view all of them
+class Interface_Model : public QAbstractTableModel
+{
+    Q_OBJECT
+
+public:
+    enum Column
+    {
+        Name,
+        Ip,
+        Subnet,
+        Gateway,
+        Dns,
+        Dns_Suffix,
+        Metric,
+        Automatic_Metric,
+        Connected,
+        Traffic,
+        Column_Count
+    };
+
+    explicit Interface_Model(QObject *parent = nullptr);
+
+    void setInterfaces(vec<shared<Interface>> interfaces);
+    void appendInterfaces(vec<shared<Interface>> interfaces);
+    const vec<shared<Interface>>& interfaces() const;
+
+    // NOTE: both keep the user's order and emit at most one burst of
+    // dataChanged / rowsRemoved / rowsInserted per call.
+    // applyChanges() returns true when interfaces came or went and a
+    // fresh enumeration has to go through mergeInterfaces()
+    bool applyChanges(const vec<Nic_Change> &changes);
+    void mergeInterfaces(vec<shared<Interface>> fresh);
+
+    // NOTE: the Traffic column reads the sampler's latest rates, call
+    // trafficUpdated() after every sample
+    void setTrafficSampler(const Traffic_Sampler *sampler);
+    void trafficUpdated();
+
+    int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+    int columnCount(const QModelIndex &parent = QModelIndex()) const override;
+    QVariant data(const QModelIndex &index, int role = Qt::DisplayRole) const override;
+    QVariant headerData(int section, Qt::Orientation orientation,
+                        int role = Qt::DisplayRole) const override;
+    Qt::ItemFlags flags(const QModelIndex &index) const override;
+
+    Qt::DropActions supportedDropActions() const override;
+    QStringList mimeTypes() const override;
+    QMimeData* mimeData(const QModelIndexList &indexes) const override;
+    bool dropMimeData(const QMimeData *data, Qt::DropAction action,
+                      int row, int column, const QModelIndex &parent) override;
+    bool moveRows(const QModelIndex &sourceParent, int sourceRow, int count,
+                  const QModelIndex &destinationParent, int destinationChild) override;
+
+private:
+    void removeRowsDescending(const vec<int> &rows);
+    void forgetCells(const shared<Interface> &nic);
+    QString formatCell(const shared<Interface> &nic, int column) const;
+    QString trafficToolTip(const shared<Interface> &nic) const;
+
+    // NOTE: cells are formatted the first time a view paints them and
+    // kept in a bounded cache, keyed by luid and column
+    static constexpr int max_cached_cells = 16 * 1024;
+
+    vec<shared<Interface>> nics;
+    const Traffic_Sampler *traffic {nullptr};
+    mutable QCache<QPair<quint64, int>, QString> cells;
+
+    // rx, tx bytes per second as last shown, -1 without a sample
+    using Shown_Rate = std::pair<qint64, qint64>;
+    std::unordered_map<u64, Shown_Rate> shown_rates;
+};
+
+#endif // INTERFACE_MODEL_H
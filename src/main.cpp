@@ -2,12 +2,14 @@
 
 #include <QApplication>
 #include "nic.h"
+#include "trace.h"
 
 int main(int argc, char *argv[])
 {
     QApplication a(argc, argv);
 
-    if (not is_running_as_administrator())
+    // NOTE: if we cannot even tell, asking for elevation is the safe bet
+    if (not is_running_as_administrator().value_or(false))
     {
         restart_as_admin();
         qDebug() << "Adiosssssssssssss";
@@ -19,5 +21,13 @@ int main(int argc, char *argv[])
     // w.setFixedSize(300, 250); // Set a fixed size for the window
     w.show();
 
-    return a.exec();
+    int res = a.exec();
+
+#ifdef QTNIC_TRACE
+    // NOTE: open it in https://ui.perfetto.dev or chrome://tracing
+    auto trace_file = qEnvironmentVariable("QTNIC_TRACE_FILE", "qtnic_trace.json");
+    write_chrome_trace(trace_file.toStdString());
+#endif
+
+    return res;
 }
@@ -1,17 +1,47 @@
 #include "main_window.h"
 #include "./ui_main_window.h"
 #include <QDebug>
+#include <QFontDatabase>
+#include <QHeaderView>
+#include <QLabel>
+#include <QtConcurrent>
 #include <QPushButton>
 #include <QShortcut>
+#include <QTimer>
 
+#include "change_coalescer.h"
+#include "interface_filter_model.h"
+#include "interface_model.h"
+#include "metrics.h"
 #include "nic.h"
+#include "trace.h"
 
 Main_Window::Main_Window(QWidget *parent)
     : QMainWindow(parent)
     , ui(new Ui::Main_Window)
+    , model(new Interface_Model(this))
+    , filter_model(new Interface_Filter_Model(model, this))
+    , coalescer(new Change_Coalescer(this))
+    , live_label(new QLabel(this))
+    , plan_label(new QLabel(this))
+    , load_watcher(new QFutureWatcher<Nic_Chunk>(this))
+    , merge_watcher(new QFutureWatcher<Nic_Chunk>(this))
+    , stats_timer(new QTimer(this))
+    , traffic_timer(new QTimer(this))
 {
     ui->setupUi(this);
 
+    ui->listView->setModel(filter_model);
+
+    // NOTE: fixed row height, so the view never has to measure rows it
+    // does not paint and the cells stay lazily formatted
+    ui->tableView->setModel(filter_model);
+    ui->tableView->verticalHeader()->setSectionResizeMode(QHeaderView::Fixed);
+    ui->tableView->horizontalHeader()->setSectionResizeMode(QHeaderView::Interactive);
+    ui->tableView->horizontalHeader()->setStretchLastSection(true);
+    ui->statusBar->addPermanentWidget(plan_label);
+    ui->statusBar->addPermanentWidget(live_label);
+
     setWindowTitle("All my interfaces");
 
     auto* quit_shortcut = new QShortcut({Qt::Key_Escape}, this);
@@ -25,7 +55,91 @@ Main_Window::Main_Window(QWidget *parent)
     connect(ui->pbSave, &QPushButton::released,
             this, &Main_Window::onPbSaveReleased);
 
+    connect(ui->filterEdit, &QLineEdit::textChanged,
+            filter_model, &Interface_Filter_Model::setFilterText);
+
+    auto* filter_shortcut = new QShortcut({Qt::CTRL | Qt::Key_F}, this);
+    connect(filter_shortcut, &QShortcut::activated,
+            this, [this](){this->ui->filterEdit->setFocus();});
+
+    connect(coalescer, &Change_Coalescer::changesReady,
+            this, &Main_Window::onNicChanges);
+
+    connect(load_watcher, &QFutureWatcher<Nic_Chunk>::resultsReadyAt,
+            this, &Main_Window::onNicChunksReady);
+    connect(load_watcher, &QFutureWatcher<Nic_Chunk>::finished,
+            this, &Main_Window::onLoadFinished);
+    connect(merge_watcher, &QFutureWatcher<Nic_Chunk>::finished,
+            this, &Main_Window::onMergeFinished);
+
+    // NOTE: the stats are always collected, they are only formatted
+    // while somebody is looking at the tab
+    ui->statsView->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    stats_timer->setInterval(1000);
+
+    connect(stats_timer, &QTimer::timeout,
+            this, &Main_Window::refreshStats);
+    connect(ui->tabWidget, &QTabWidget::currentChanged,
+            this, [this](int index)
+            {
+                if (ui->tabWidget->widget(index) == ui->tabStats)
+                {
+                    refreshStats();
+                    stats_timer->start();
+                }
+                else
+                {
+                    stats_timer->stop();
+                }
+            });
+
+    // NOTE: rates need two samples, the first one only sets the baseline
+    model->setTrafficSampler(&traffic);
+    traffic.sample();
+    traffic_timer->setInterval(1000);
+    connect(traffic_timer, &QTimer::timeout,
+            this, &Main_Window::sampleTraffic);
+    traffic_timer->start();
+
+    // NOTE: the dry run is redone after every drag, the plan is reused so
+    // this stays cheap even with thousands of rows
+    connect(model, &Interface_Model::rowsMoved,
+            this, &Main_Window::updatePlanPreview);
+    connect(model, &Interface_Model::rowsInserted,
+            this, &Main_Window::updatePlanPreview);
+    connect(model, &Interface_Model::rowsRemoved,
+            this, &Main_Window::updatePlanPreview);
+    connect(model, &Interface_Model::modelReset,
+            this, &Main_Window::updatePlanPreview);
+    connect(model, &Interface_Model::dataChanged,
+            this, [this](const QModelIndex &top_left, const QModelIndex &bottom_right)
+            {
+                if (top_left.column() <= Interface_Model::Automatic_Metric and
+                    bottom_right.column() >= Interface_Model::Metric)
+                {
+                    updatePlanPreview();
+                }
+            });
+
     loadAllNics();
+
+    // NOTE: link flaps are followed live, the coalescer makes sure a
+    // storm of them is at most one model update per frame
+    auto watched = watch_nic_changes(
+        [coalescer = this->coalescer](const Nic_Change& change)
+        {
+            coalescer->push(change);
+        });
+
+    if (watched)
+    {
+        watch = std::move(*watched);
+    }
+    else
+    {
+        live_label->setText("not live");
+        live_label->setToolTip(QString::fromStdString(to_string(watched.error())));
+    }
 }
 
 void Main_Window::keyPressEvent(QKeyEvent *event)
@@ -42,55 +156,242 @@ void Main_Window::keyPressEvent(QKeyEvent *event)
 void Main_Window::closeEvent(QCloseEvent *event)
 {
     // qDebug() << "goodbyeeeeeeeeeeeee";
+
+    // NOTE: the job owns nothing of ours, it notices the cancel between
+    // two adapters and winds down on its own
+    load_watcher->cancel();
+
     QMainWindow::closeEvent(event);
 }
 
 Main_Window::~Main_Window()
 {
+    // stop the notifications before the coalescer goes away
+    watch.reset();
     delete ui;
 }
 
 void Main_Window::loadAllNics()
 {
-    ui->plainTextEdit->clear();
+    QTNIC_TRACE_SCOPE("Main_Window::loadAllNics");
+
+    constexpr size_t chunk_size = 32;
 
-    auto nics = collect_nic_info();
+    load_watcher->cancel();
+    model->setInterfaces({});
 
-    for (const auto& nic : nics)
+    ui->pbSave->setEnabled(false);
+    ui->statusBar->showMessage("Loading interfaces...");
+
+    // NOTE: GetAdaptersAddresses can take seconds with lots of virtual
+    // adapters, so it runs on the pool and streams rows in as it goes,
+    // every network compartment one after the other
+    auto future = QtConcurrent::run([](QPromise<Nic_Chunk>& promise)
     {
-        const auto& name = get_name(nic);
-        ui->plainTextEdit->appendPlainText(QString::fromUtf8(name.data(), -1));
-    }
+        QTNIC_TRACE_SCOPE("Main_Window load job");
+
+        Nic_Chunk chunk;
+        chunk.nics.reserve(chunk_size);
+
+        auto res = collect_nic_info(
+            list_network_compartments(),
+            Nic_Filter {},
+            [&promise, &chunk](shared<Interface> nic)
+            {
+                if (promise.isCanceled())
+                    return false;
+
+                chunk.nics.push_back(std::move(nic));
+
+                if (chunk.nics.size() == chunk_size)
+                {
+                    promise.addResult(std::move(chunk));
+                    chunk = {};
+                    chunk.nics.reserve(chunk_size);
+                }
+
+                return true;
+            });
+
+        if (not res)
+            chunk.error = res.error();
+
+        if (not chunk.nics.empty() or chunk.error)
+            promise.addResult(std::move(chunk));
+    });
+
+    load_watcher->setFuture(future);
 }
 
-void Main_Window::onPbSaveReleased()
+void Main_Window::onNicChunksReady(int begin, int end)
 {
-    auto content = ui->plainTextEdit->toPlainText().toStdString();
-    try
+    QTNIC_TRACE_SCOPE("Main_Window::onNicChunksReady");
+
+    for (int i = begin; i < end; ++i)
     {
-        auto nics = collect_nic_info();
-        u32 skipped = update_nic_metric(nics, content);
-        if (skipped == 0)
-        {
-        ui->statusBar->showMessage("All good!", 3000);
-    }
-        else
+        auto chunk = load_watcher->resultAt(i);
+
+        if (chunk.error)
         {
-            ui->statusBar->showMessage(
-                QString("Warning! %1 interface/s skipped").arg(skipped), 
-                3000);
+            auto msg = QString::fromStdString(to_string(*chunk.error));
+            ui->statusBar->showMessage(msg, 6000);
         }
+
+        model->appendInterfaces(std::move(chunk.nics));
     }
-    catch (str_cref e)
+}
+
+void Main_Window::onLoadFinished()
+{
+    if (load_watcher->isCanceled())
+        return;
+
+    ui->pbSave->setEnabled(true);
+
+    if (ui->statusBar->currentMessage() == "Loading interfaces...")
+        ui->statusBar->clearMessage();
+}
+
+void Main_Window::startMerge()
+{
+    // NOTE: interfaces came or went. The enumeration runs on the pool like
+    // the first load, and a storm of changes while it runs costs just one
+    // more enumeration once it is done
+    if (merge_watcher->isRunning())
     {
-        auto msg = QString("%1").arg(e.data());
+        merge_pending = true;
+        return;
+    }
+
+    merge_pending = false;
+
+    merge_watcher->setFuture(QtConcurrent::run([]()
+    {
+        QTNIC_TRACE_SCOPE("Main_Window merge job");
+
+        Nic_Chunk chunk;
+
+        if (auto nics = collect_nic_info(list_network_compartments()); nics)
+            chunk.nics = std::move(*nics);
+        else
+            chunk.error = nics.error();
+
+        return chunk;
+    }));
+}
+
+void Main_Window::onMergeFinished()
+{
+    QTNIC_TRACE_SCOPE("Main_Window::onMergeFinished");
+
+    auto chunk = merge_watcher->result();
+
+    if (chunk.error)
+    {
+        auto msg = QString::fromStdString(to_string(*chunk.error));
         ui->statusBar->showMessage(msg, 6000);
-        // qDebug() << e;
     }
-    catch (const std::exception& e)
+    else if (load_watcher->isFinished())
     {
-        auto msg = QString("%1").arg(e.what());
+        // a full reload started meanwhile has the fresher picture
+        model->mergeInterfaces(std::move(chunk.nics));
+    }
+
+    if (merge_pending)
+        startMerge();
+}
+
+void Main_Window::onPbSaveReleased()
+{
+    QTNIC_TRACE_SCOPE("Main_Window::onPbSaveReleased");
+
+    // NOTE: the rows already are the interfaces, no names to re-match
+    auto plan = plan_nic_metric(model->interfaces());
+    auto res = apply_nic_metric_plan(plan);
+
+    if (not res)
+    {
+        auto msg = QString::fromStdString(to_string(res.error()));
         ui->statusBar->showMessage(msg, 6000);
-        // qDebug() << "[EXC] " << e.what();
+        return;
+    }
+
+    ui->statusBar->showMessage("All good!", 3000);
+}
+
+void Main_Window::refreshStats()
+{
+    ui->statsView->setPlainText(QString::fromStdString(nic_op_stats_text()));
+}
+
+void Main_Window::updatePlanPreview()
+{
+    QTNIC_TRACE_SCOPE("Main_Window::updatePlanPreview");
+
+    plan_nic_metric(model->interfaces(), plan_preview);
+    auto cost = estimate_plan_cost(plan_preview);
+
+    if (cost.writes == 0)
+    {
+        plan_label->setText("no changes");
+        ui->pbSave->setToolTip({});
+        return;
+    }
+
+    plan_label->setText(QString("%1 write/s, ~%2 ms%3")
+                            .arg(cost.writes)
+                            .arg(double(cost.estimated_ns) / 1e6, 0, 'f', 1)
+                            .arg(cost.measured ? "" : " (not measured yet)"));
+
+    // NOTE: at most a screenful in the tooltip, the label has the total
+    constexpr int max_lines = 30;
+    QStringList lines;
+
+    for (const auto& write : plan_preview.writes)
+    {
+        if (changed_families(write) == 0)
+            continue;
+
+        if (lines.size() == max_lines)
+        {
+            lines << "...";
+            break;
+        }
+
+        auto old_metric = write.old_metric ? write.old_metric : write.old_metric_v6;
+        const auto& name = get_name(write.nic);
+
+        lines << QString("%1: %2 -> %3%4")
+                     .arg(QString::fromUtf8(name.data(), qsizetype(name.size())))
+                     .arg(old_metric ? QString::number(*old_metric) : QString("-"))
+                     .arg(write.new_metric)
+                     .arg(write.disable_automatic ? " (automatic metric off)" : "");
     }
+
+    ui->pbSave->setToolTip(lines.join('\n'));
+}
+
+void Main_Window::sampleTraffic()
+{
+    if (auto res = traffic.sample(); not res)
+    {
+        traffic_timer->stop();
+        ui->statusBar->showMessage(QString::fromStdString(to_string(res.error())), 6000);
+        return;
+    }
+
+    model->trafficUpdated();
+}
+
+void Main_Window::onNicChanges(const vec<Nic_Change> &changes)
+{
+    QTNIC_TRACE_SCOPE("Main_Window::onNicChanges");
+
+    // NOTE: a load still running will pick up new interfaces anyway
+    if (model->applyChanges(changes) and load_watcher->isFinished())
+        startMerge();
+
+    live_label->setText(QString("live: %1 events, %2 coalesced")
+                            .arg(coalescer->receivedEvents())
+                            .arg(coalescer->coalescedEvents()));
 }
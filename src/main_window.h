@@ -1,14 +1,33 @@
 #ifndef MAIN_WINDOW_H
 #define MAIN_WINDOW_H
 
+#include <QFutureWatcher>
 #include <QMainWindow>
 
+#include <optional>
+
+#include "nic.h"
+#include "traffic_sampler.h"
+
 QT_BEGIN_NAMESPACE
 namespace Ui {
 class Main_Window;
 }
 QT_END_NAMESPACE
 
+class QLabel;
+class QTimer;
+class Change_Coalescer;
+class Interface_Model;
+class Interface_Filter_Model;
+
+// NOTE: one streamed piece of the background enumeration
+struct Nic_Chunk
+{
+    vec<shared<Interface>> nics;
+    std::optional<Nic_Error> error;
+};
+
 class Main_Window : public QMainWindow
 {
     Q_OBJECT
@@ -20,12 +39,34 @@ public:
 public slots:
     void loadAllNics();
     void onPbSaveReleased();
+    void onNicChanges(const vec<Nic_Change> &changes);
+    void onNicChunksReady(int begin, int end);
+    void onLoadFinished();
+    void onMergeFinished();
+    void refreshStats();
+    void sampleTraffic();
+    void updatePlanPreview();
 
 protected:
     void keyPressEvent(QKeyEvent *event) override;
     void closeEvent(QCloseEvent *event) override;
 
 private:
+    void startMerge();
+
     Ui::Main_Window *ui;
+    Interface_Model *model;
+    Interface_Filter_Model *filter_model;
+    Change_Coalescer *coalescer;
+    QLabel *live_label;
+    QLabel *plan_label;
+    shared<Nic_Watch> watch;
+    QFutureWatcher<Nic_Chunk> *load_watcher;
+    QFutureWatcher<Nic_Chunk> *merge_watcher;
+    bool merge_pending {false};
+    QTimer *stats_timer;
+    QTimer *traffic_timer;
+    Traffic_Sampler traffic;
+    Metric_Plan plan_preview;
 };
 #endif // MAIN_WINDOW_H
@@ -0,0 +1,299 @@
+#include "metrics.h"
+
+#include <bit>
+#include <format>
+#include <mutex>
+
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+
+void Latency_Histogram::record(u64 ns)
+{
+    buckets[bucket_of(ns)].fetch_add(1, std::memory_order_relaxed);
+    total.fetch_add(1, std::memory_order_relaxed);
+    total_ns.fetch_add(ns, std::memory_order_relaxed);
+
+    u64 seen = max_ns.load(std::memory_order_relaxed);
+    while (ns > seen and
+           not max_ns.compare_exchange_weak(seen, ns, std::memory_order_relaxed))
+    {
+    }
+}
+
+void Latency_Histogram::merge(const Latency_Histogram& other)
+{
+    for (size_t bucket = 0; bucket < bucket_count; ++bucket)
+    {
+        u64 n = other.buckets[bucket].load(std::memory_order_relaxed);
+
+        if (n != 0)
+            buckets[bucket].fetch_add(n, std::memory_order_relaxed);
+    }
+
+    total.fetch_add(other.count(), std::memory_order_relaxed);
+    total_ns.fetch_add(other.sum(), std::memory_order_relaxed);
+
+    u64 other_max = other.max();
+    u64 seen = max_ns.load(std::memory_order_relaxed);
+    while (other_max > seen and
+           not max_ns.compare_exchange_weak(seen, other_max, std::memory_order_relaxed))
+    {
+    }
+}
+
+u64 Latency_Histogram::count() const
+{
+    return total.load(std::memory_order_relaxed);
+}
+
+u64 Latency_Histogram::sum() const
+{
+    return total_ns.load(std::memory_order_relaxed);
+}
+
+u64 Latency_Histogram::max() const
+{
+    return max_ns.load(std::memory_order_relaxed);
+}
+
+u64 Latency_Histogram::percentile(double p) const
+{
+    u64 n = count();
+
+    if (n == 0)
+        return 0;
+
+    // NOTE: rank of the wanted sample, 1 based
+    u64 rank = std::max<u64>(1, static_cast<u64>(p / 100.0 * double(n) + 0.5));
+    u64 seen = 0;
+
+    for (size_t bucket = 0; bucket < bucket_count; ++bucket)
+    {
+        seen += buckets[bucket].load(std::memory_order_relaxed);
+
+        if (seen >= rank)
+            return std::min(lower_bound_of(bucket), max());
+    }
+
+    return max();
+}
+
+str Latency_Histogram::summary() const
+{
+    auto us = [](u64 ns) { return double(ns) / 1000.0; };
+
+    return std::format("n={} p50={:.1f}us p90={:.1f}us p99={:.1f}us max={:.1f}us",
+                       count(),
+                       us(percentile(50)),
+                       us(percentile(90)),
+                       us(percentile(99)),
+                       us(max()));
+}
+
+size_t Latency_Histogram::bucket_of(u64 ns)
+{
+    if (ns < 16)
+        return static_cast<size_t>(ns);
+
+    // shift so the top 4 bits land in [8, 15]
+    u32 shift = static_cast<u32>(std::bit_width(ns)) - 4;
+    return 16 + (shift - 1) * 8 + static_cast<size_t>((ns >> shift) - 8);
+}
+
+u64 Latency_Histogram::lower_bound_of(size_t bucket)
+{
+    if (bucket < 16)
+        return bucket;
+
+    u32 shift = static_cast<u32>((bucket - 16) / 8) + 1;
+    u64 mantissa = (bucket - 16) % 8 + 8;
+    return mantissa << shift;
+}
+
+
+// NOTE: one per thread, only its owner writes to it
+struct Op_Shard
+{
+    std::array<std::atomic<u64>, nic_op_count> failures {};
+    std::array<Latency_Histogram, nic_op_count> latency;
+};
+
+static void merge_shard(Op_Shard& into, const Op_Shard& from)
+{
+    for (size_t i = 0; i < nic_op_count; ++i)
+    {
+        into.latency[i].merge(from.latency[i]);
+        into.failures[i].fetch_add(from.failures[i].load(std::memory_order_relaxed),
+                                   std::memory_order_relaxed);
+    }
+}
+
+struct Op_Registry
+{
+    std::mutex mutex;
+    vec<const Op_Shard*> shards; // threads still running
+    Op_Shard retired; // everything recorded by threads that are gone
+};
+
+static Op_Registry& op_registry()
+{
+    static Op_Registry instance;
+    return instance;
+}
+
+// NOTE: a thread's shard is folded into the retired totals when the
+// thread exits, so short lived workers leave nothing behind and the
+// stats only ever walk the threads that are alive
+struct Thread_Shard
+{
+    Thread_Shard()
+    {
+        auto& registry = op_registry();
+        std::scoped_lock lock(registry.mutex);
+        registry.shards.push_back(&shard);
+    }
+
+    ~Thread_Shard()
+    {
+        auto& registry = op_registry();
+        std::scoped_lock lock(registry.mutex);
+
+        merge_shard(registry.retired, shard);
+        std::erase(registry.shards, &shard);
+    }
+
+    Op_Shard shard;
+};
+
+static Op_Shard& thread_shard()
+{
+    // NOTE: op_registry() is constructed first, so it outlives this
+    thread_local Thread_Shard owned;
+    return owned.shard;
+}
+
+const char* to_string(Nic_Op op)
+{
+    switch (op)
+    {
+    case Nic_Op::enumerate: return "enumerate";
+    case Nic_Op::get_ip_interface_entry: return "get_ip_interface_entry";
+    case Nic_Op::set_ip_interface_entry: return "set_ip_interface_entry";
+    case Nic_Op::match: return "match";
+    case Nic_Op::apply: return "apply";
+    }
+
+    return "unknown";
+}
+
+void record_nic_op(Nic_Op op, u64 ns, bool failed)
+{
+    auto& shard = thread_shard();
+    auto i = static_cast<size_t>(op);
+
+    shard.latency[i].record(ns);
+
+    if (failed)
+        shard.failures[i].fetch_add(1, std::memory_order_relaxed);
+}
+
+Op_Timer::Op_Timer(Nic_Op op)
+    : op(op)
+    , start(std::chrono::steady_clock::now())
+{
+}
+
+Op_Timer::~Op_Timer()
+{
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    record_nic_op(op,
+                  static_cast<u64>(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()),
+                  failed);
+}
+
+void Op_Timer::fail()
+{
+    failed = true;
+}
+
+vec<Nic_Op_Stats> nic_op_stats()
+{
+    Op_Shard totals;
+
+    {
+        auto& registry = op_registry();
+        std::scoped_lock lock(registry.mutex);
+
+        merge_shard(totals, registry.retired);
+
+        for (const auto* shard : registry.shards)
+            merge_shard(totals, *shard);
+    }
+
+    const auto& latency = totals.latency;
+    const auto& failures = totals.failures;
+
+    vec<Nic_Op_Stats> stats;
+    stats.reserve(nic_op_count);
+
+    for (size_t i = 0; i < nic_op_count; ++i)
+    {
+        stats.push_back({
+            .op = static_cast<Nic_Op>(i),
+            .calls = latency[i].count(),
+            .failures = failures[i].load(std::memory_order_relaxed),
+            .total_ns = latency[i].sum(),
+            .p50_ns = latency[i].percentile(50),
+            .p90_ns = latency[i].percentile(90),
+            .p99_ns = latency[i].percentile(99),
+            .max_ns = latency[i].max()});
+    }
+
+    return stats;
+}
+
+str nic_op_stats_text()
+{
+    auto us = [](u64 ns) { return double(ns) / 1000.0; };
+    str text;
+
+    for (const auto& stat : nic_op_stats())
+    {
+        text += std::format("{:<24} calls={} failed={} p50={:.1f}us p90={:.1f}us p99={:.1f}us max={:.1f}us\n",
+                            to_string(stat.op),
+                            stat.calls,
+                            stat.failures,
+                            us(stat.p50_ns),
+                            us(stat.p90_ns),
+                            us(stat.p99_ns),
+                            us(stat.max_ns));
+    }
+
+    return text;
+}
+
+str nic_op_stats_json()
+{
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> json(buffer);
+
+    json.StartObject();
+
+    for (const auto& stat : nic_op_stats())
+    {
+        json.Key(to_string(stat.op));
+        json.StartObject();
+        json.Key("calls"); json.Uint64(stat.calls);
+        json.Key("failures"); json.Uint64(stat.failures);
+        json.Key("total_ns"); json.Uint64(stat.total_ns);
+        json.Key("p50_ns"); json.Uint64(stat.p50_ns);
+        json.Key("p90_ns"); json.Uint64(stat.p90_ns);
+        json.Key("p99_ns"); json.Uint64(stat.p99_ns);
+        json.Key("max_ns"); json.Uint64(stat.max_ns);
+        json.EndObject();
+    }
+
+    json.EndObject();
+
+    return str(buffer.GetString(), buffer.GetSize());
+}
@@ -0,0 +1,92 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <array>
+#include <atomic>
+#include <chrono>
+
+#include "nic.h"
+
+// NOTE: HDR style latency histogram in nanoseconds. Values below 16 get
+// their own bucket, above that every power of two is split in 8 linear
+// sub-buckets, so any value is off by at most 12.5% and the whole range
+// of u64 fits in a fixed array. record() is a couple of relaxed atomic
+// adds, safe from any thread.
+class Latency_Histogram
+{
+public:
+    static constexpr size_t bucket_count = 16 + 60 * 8;
+
+    void record(u64 ns);
+    void merge(const Latency_Histogram& other);
+
+    u64 count() const;
+    u64 sum() const;
+    u64 max() const;
+    u64 percentile(double p) const; // p in [0, 100]
+
+    str summary() const; // "n=.. p50=.. p90=.. p99=.. max=.." in microseconds
+
+private:
+    static size_t bucket_of(u64 ns);
+    static u64 lower_bound_of(size_t bucket);
+
+    std::array<std::atomic<u64>, bucket_count> buckets {};
+    std::atomic<u64> total {0};
+    std::atomic<u64> total_ns {0};
+    std::atomic<u64> max_ns {0};
+};
+
+// NOTE: the operations we keep always-on stats for
+enum class Nic_Op : u8
+{
+    enumerate,
+    get_ip_interface_entry,
+    set_ip_interface_entry,
+    match,
+    apply,
+};
+
+constexpr size_t nic_op_count = 5;
+
+const char* to_string(Nic_Op op);
+
+// NOTE: always on, unlike the trace spans. Every thread records into a
+// shard of its own, so a record is a few uncontended relaxed adds and
+// nothing is ever locked after the first one; readers sum the shards
+void record_nic_op(Nic_Op op, u64 ns, bool failed = false);
+
+class Op_Timer
+{
+public:
+    explicit Op_Timer(Nic_Op op);
+    ~Op_Timer();
+
+    Op_Timer(const Op_Timer&) = delete;
+    Op_Timer& operator=(const Op_Timer&) = delete;
+
+    void fail();
+
+private:
+    Nic_Op op;
+    bool failed {false};
+    std::chrono::steady_clock::time_point start;
+};
+
+struct Nic_Op_Stats
+{
+    Nic_Op op {};
+    u64 calls {0};
+    u64 failures {0};
+    u64 total_ns {0};
+    u64 p50_ns {0};
+    u64 p90_ns {0};
+    u64 p99_ns {0};
+    u64 max_ns {0};
+};
+
+vec<Nic_Op_Stats> nic_op_stats();
+str nic_op_stats_text(); // one line per operation
+str nic_op_stats_json(); // compact, one object keyed by operation
+
+#endif // METRICS_H
@@ -0,0 +1,225 @@
+#include "name_index.h"
+
+#include <algorithm>
+
+#include "utf8.h"
+
+static u32 trigram_at(str_cref text, size_t pos)
+{
+    return (u32(u8(text[pos])) << 16) |
+           (u32(u8(text[pos + 1])) << 8) |
+           u32(u8(text[pos + 2]));
+}
+
+str fold_case(str_cref text)
+{
+    str folded;
+    folded.reserve(text.size());
+
+    auto* it = reinterpret_cast<const utf8_int8_t*>(text.c_str());
+
+    // NOTE: stops at the first '\0'
+    while (*it != '\0')
+    {
+        utf8_int32_t codepoint = 0;
+        it = utf8codepoint(it, &codepoint);
+
+        utf8_int8_t buffer[4] {};
+        auto* end = utf8catcodepoint(buffer, utf8lwrcodepoint(codepoint), sizeof(buffer));
+
+        if (end != nullptr)
+            folded.append(reinterpret_cast<const char*>(buffer), end - buffer);
+    }
+
+    return folded;
+}
+
+str normalize_name(str_cref name)
+{
+    str folded = fold_case(name);
+    str key;
+    key.reserve(folded.size());
+
+    bool pending_space = false;
+
+    for (char c : folded)
+    {
+        if (c == ' ' or c == '\t' or c == '\r' or c == '\n' or c == '\f' or c == '\v')
+        {
+            pending_space = not key.empty();
+            continue;
+        }
+
+        if (pending_space)
+            key.push_back(' ');
+
+        pending_space = false;
+        key.push_back(c);
+    }
+
+    return key;
+}
+
+void Name_Index::build(const vec<shared<Interface>>& interfaces)
+{
+    luids.clear();
+    keys.clear();
+    id_of_luid.clear();
+    trigrams.clear();
+
+    luids.reserve(interfaces.size());
+    keys.reserve(interfaces.size());
+    id_of_luid.reserve(interfaces.size());
+
+    for (const auto& nic : interfaces)
+        insert(nic);
+
+    // forget the previous query, the ids behind it are gone
+    last_query.clear();
+    hits.resize(keys.size());
+    for (u32 id = 0; id < hits.size(); ++id)
+        hits[id] = id;
+    hit_mask.assign(keys.size(), 1);
+}
+
+void Name_Index::add(const vec<shared<Interface>>& interfaces, size_t first)
+{
+    for (size_t i = first; i < interfaces.size(); ++i)
+    {
+        if (contains(get_luid(interfaces[i])))
+            continue;
+
+        u32 id = insert(interfaces[i]);
+
+        // ids only grow, so hits stays sorted
+        bool hit = last_query.empty() or keys[id].find(last_query) != str::npos;
+
+        if (hit)
+            hits.push_back(id);
+
+        hit_mask.push_back(hit ? 1 : 0);
+    }
+}
+
+u32 Name_Index::insert(const shared<Interface>& nic)
+{
+    u32 id = static_cast<u32>(keys.size());
+
+    luids.push_back(get_luid(nic));
+    id_of_luid.emplace(luids.back(), id);
+
+    str key = fold_case(get_name(nic));
+    key.append("\n").append(fold_case(get_description(nic)));
+    keys.push_back(std::move(key));
+
+    str_cref stored = keys.back();
+
+    for (size_t pos = 0; pos + 3 <= stored.size(); ++pos)
+    {
+        auto& posting = trigrams[trigram_at(stored, pos)];
+
+        // the same trigram twice in one key is recorded once
+        if (posting.empty() or posting.back() != id)
+            posting.push_back(id);
+    }
+
+    return id;
+}
+
+size_t Name_Index::query(str_cref text)
+{
+    search(fold_case(text));
+    return hits.size();
+}
+
+void Name_Index::search(str_cref folded)
+{
+    vec<u32> candidates;
+
+    if (folded.empty())
+    {
+        candidates.resize(keys.size());
+        for (u32 id = 0; id < candidates.size(); ++id)
+            candidates[id] = id;
+
+        hits = std::move(candidates);
+        hit_mask.assign(keys.size(), 1);
+        last_query.clear();
+        return;
+    }
+
+    // the shortest posting list of the query bounds the candidates
+    const vec<u32>* shortest = nullptr;
+    bool impossible = false;
+
+    for (size_t pos = 0; pos + 3 <= folded.size(); ++pos)
+    {
+        auto it = trigrams.find(trigram_at(folded, pos));
+
+        if (it == trigrams.end())
+        {
+            impossible = true;
+            break;
+        }
+
+        if (shortest == nullptr or it->second.size() < shortest->size())
+            shortest = &it->second;
+    }
+
+    // narrowing: whatever matches now matched the previous query as well
+    bool narrowing = not last_query.empty() and
+                     folded.find(last_query) != str::npos;
+
+    if (impossible)
+    {
+        candidates.clear();
+    }
+    else if (narrowing and (shortest == nullptr or hits.size() <= shortest->size()))
+    {
+        candidates = std::move(hits);
+    }
+    else if (shortest != nullptr)
+    {
+        candidates = *shortest;
+    }
+    else
+    {
+        candidates.resize(keys.size());
+        for (u32 id = 0; id < candidates.size(); ++id)
+            candidates[id] = id;
+    }
+
+    std::fill(hit_mask.begin(), hit_mask.end(), u8(0));
+
+    auto confirmed = std::remove_if(
+        candidates.begin(),
+        candidates.end(),
+        [this, &folded](u32 id)
+        {
+            return keys[id].find(folded) == str::npos;
+        });
+
+    candidates.erase(confirmed, candidates.end());
+
+    for (u32 id : candidates)
+        hit_mask[id] = 1;
+
+    hits = std::move(candidates);
+    last_query = folded;
+}
+
+bool Name_Index::contains(u64 luid) const
+{
+    return id_of_luid.contains(luid);
+}
+
+bool Name_Index::matches(u64 luid) const
+{
+    auto it = id_of_luid.find(luid);
+    return it != id_of_luid.end() and hit_mask[it->second] != 0;
+}
+
+size_t Name_Index::size() const
+{
+    return keys.size();
+}
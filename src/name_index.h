@@ -0,0 +1,51 @@
+#ifndef NAME_INDEX_H
+#define NAME_INDEX_H
+
+#include <unordered_map>
+
+#include "nic.h"
+
+// NOTE: lower case version of an utf-8 string, used for every case
+// insensitive lookup so names and queries are folded the same way
+str fold_case(str_cref text);
+
+// NOTE: fold_case() plus every run of whitespace squeezed into a single
+// space and none at either end, the key of Name_Match::loose
+str normalize_name(str_cref name);
+
+// NOTE: substring search over case folded names and descriptions.
+// Built once per enumeration, a query first intersects the trigram
+// posting lists and only then confirms the survivors, and a query that
+// extends the previous one only rescans the previous hits.
+// Entries are keyed by luid so they survive reorders and live updates.
+class Name_Index
+{
+public:
+    void build(const vec<shared<Interface>>& interfaces);
+
+    // NOTE: indexes the interfaces from first on it does not know yet and
+    // judges them against the last query, rows streaming in need no build
+    void add(const vec<shared<Interface>>& interfaces, size_t first = 0);
+
+    // returns the number of matching interfaces
+    size_t query(str_cref text);
+
+    bool contains(u64 luid) const;
+    bool matches(u64 luid) const;
+    size_t size() const;
+
+private:
+    u32 insert(const shared<Interface>& nic);
+    void search(str_cref folded);
+
+    vec<u64> luids;
+    vec<str> keys; // folded "name\ndescription"
+    std::unordered_map<u64, u32> id_of_luid;
+    std::unordered_map<u32, vec<u32>> trigrams;
+
+    str last_query;
+    vec<u32> hits;
+    vec<u8> hit_mask;
+};
+
+#endif // NAME_INDEX_H
@@ -0,0 +1,978 @@
+#include "name_matcher.h"
+
+#include <algorithm>
+#include <bitset>
+#include <format>
+
+#include "utf8.h"
+
+// NOTE: patterns are parsed into a small tree first, only so {m,n} can
+// stamp out its operand more than once
+struct Rx_Node
+{
+    enum Kind : u8 { empty, literal, set, concat, alternate, repeat };
+
+    Kind kind {empty};
+    str bytes; // literal, one utf-8 encoded character
+
+    // set, ascii members are a bitmap, other characters are listed
+    std::bitset<128> ascii;
+    vec<str> multibyte;
+    bool negated {false};
+
+    vec<Rx_Node> children;
+    u32 min {0};
+    u32 max {0}; // repeat
+};
+
+static constexpr u32 unbounded = ~u32(0);
+static constexpr u32 max_repeat = 64;
+
+static u32 utf8_length(u8 lead)
+{
+    if (lead < 0x80) return 1;
+    if ((lead & 0xE0) == 0xC0) return 2;
+    if ((lead & 0xF0) == 0xE0) return 3;
+    if ((lead & 0xF8) == 0xF0) return 4;
+    return 1; // stray continuation byte, taken as it is
+}
+
+// NOTE: one utf-8 character and its lower and upper case forms, the same
+// tables fold_case() uses. A truncated sequence is left alone
+static vec<str> case_variants(string_view character)
+{
+    vec<str> variants {str(character)};
+
+    if (character.size() != utf8_length(u8(character.front())))
+        return variants;
+
+    utf8_int32_t code_point = 0;
+    utf8codepoint(reinterpret_cast<const utf8_int8_t*>(variants.front().c_str()), &code_point);
+
+    for (auto folded : {utf8lwrcodepoint(code_point), utf8uprcodepoint(code_point)})
+    {
+        utf8_int8_t buffer[4] {};
+        auto* end = utf8catcodepoint(buffer, folded, sizeof(buffer));
+
+        if (end == nullptr)
+            continue;
+
+        str variant(reinterpret_cast<const char*>(buffer), end - buffer);
+
+        if (std::find(variants.begin(), variants.end(), variant) == variants.end())
+            variants.push_back(std::move(variant));
+    }
+
+    return variants;
+}
+
+static Rx_Node make_node(Rx_Node::Kind kind)
+{
+    Rx_Node node;
+    node.kind = kind;
+    return node;
+}
+
+static Rx_Node any_character()
+{
+    auto node = make_node(Rx_Node::set);
+    node.negated = true;
+    return node;
+}
+
+class Rx_Parser
+{
+public:
+    Rx_Parser(string_view pattern, bool fold)
+        : text(pattern)
+        , fold(fold)
+    {
+    }
+
+    Rx_Node parse_glob()
+    {
+        auto root = make_node(Rx_Node::concat);
+
+        while (pos < text.size())
+        {
+            if (text[pos] == '*')
+            {
+                ++pos;
+                auto star = make_node(Rx_Node::repeat);
+                star.max = unbounded;
+                star.children.push_back(any_character());
+                root.children.push_back(std::move(star));
+            }
+            else if (text[pos] == '?')
+            {
+                ++pos;
+                root.children.push_back(any_character());
+            }
+            else
+            {
+                root.children.push_back(literal(next_character()));
+            }
+        }
+
+        return root;
+    }
+
+    Rx_Node parse_regex()
+    {
+        if (text.starts_with("(?i)"))
+        {
+            fold = true;
+            pos = 4;
+        }
+
+        auto root = parse_alternate();
+
+        if (error.empty() and pos < text.size())
+            fail("unmatched )");
+
+        return root;
+    }
+
+    str error;
+
+private:
+    void fail(string_view message)
+    {
+        if (error.empty())
+            error = std::format("{} at offset {}", message, pos);
+    }
+
+    bool at(char c) const
+    {
+        return pos < text.size() and text[pos] == c;
+    }
+
+    string_view next_character()
+    {
+        u32 length = std::min<size_t>(utf8_length(u8(text[pos])), text.size() - pos);
+        auto character = text.substr(pos, length);
+        pos += length;
+        return character;
+    }
+
+    void add_ascii(Rx_Node& node, u8 c)
+    {
+        // a stray byte is matched as it is
+        if (c >= 0x80)
+        {
+            node.multibyte.emplace_back(1, char(c));
+            return;
+        }
+
+        node.ascii.set(c);
+
+        if (fold and c >= 'a' and c <= 'z')
+            node.ascii.set(c - 'a' + 'A');
+        if (fold and c >= 'A' and c <= 'Z')
+            node.ascii.set(c - 'A' + 'a');
+    }
+
+    void add_to_set(Rx_Node& node, string_view character)
+    {
+        if (character.size() == 1)
+        {
+            add_ascii(node, u8(character.front()));
+            return;
+        }
+
+        if (not fold)
+        {
+            node.multibyte.emplace_back(character);
+            return;
+        }
+
+        for (auto& variant : case_variants(character))
+            node.multibyte.push_back(std::move(variant));
+    }
+
+    Rx_Node literal(string_view character)
+    {
+        bool letter = character.size() == 1 and
+            ((character[0] >= 'a' and character[0] <= 'z') or
+             (character[0] >= 'A' and character[0] <= 'Z'));
+
+        if (fold and (letter or character.size() > 1))
+        {
+            auto node = make_node(Rx_Node::set);
+            add_to_set(node, character);
+
+            // no case to fold, a plain literal is a smaller nfa
+            if (letter or node.multibyte.size() > 1)
+                return node;
+        }
+
+        auto node = make_node(Rx_Node::literal);
+        node.bytes = character;
+        return node;
+    }
+
+    Rx_Node parse_alternate()
+    {
+        auto node = make_node(Rx_Node::alternate);
+        node.children.push_back(parse_branch());
+
+        while (error.empty() and at('|'))
+        {
+            ++pos;
+            node.children.push_back(parse_branch());
+        }
+
+        if (node.children.size() == 1)
+            return std::move(node.children.front());
+
+        return node;
+    }
+
+    Rx_Node parse_branch()
+    {
+        if (depth == 0)
+            branch = pos;
+
+        return parse_concat();
+    }
+
+    Rx_Node parse_concat()
+    {
+        auto node = make_node(Rx_Node::concat);
+
+        while (error.empty() and pos < text.size() and not at('|') and not at(')'))
+            node.children.push_back(parse_repeat());
+
+        return node;
+    }
+
+    Rx_Node parse_repeat()
+    {
+        auto atom = parse_atom();
+
+        while (error.empty() and pos < text.size())
+        {
+            u32 min = 0;
+            u32 max = 0;
+
+            if (at('*'))
+            {
+                ++pos;
+                max = unbounded;
+            }
+            else if (at('+'))
+            {
+                ++pos;
+                min = 1;
+                max = unbounded;
+            }
+            else if (at('?'))
+            {
+                ++pos;
+                max = 1;
+            }
+            else if (at('{'))
+            {
+                if (not parse_count(min, max))
+                    break;
+            }
+            else
+            {
+                break;
+            }
+
+            auto node = make_node(Rx_Node::repeat);
+            node.min = min;
+            node.max = max;
+            node.children.push_back(std::move(atom));
+            atom = std::move(node);
+        }
+
+        return atom;
+    }
+
+    bool parse_number(u32& value)
+    {
+        size_t first = pos;
+        value = 0;
+
+        while (pos < text.size() and text[pos] >= '0' and text[pos] <= '9')
+        {
+            value = std::min<u32>(value * 10 + u32(text[pos] - '0'), max_repeat + 1);
+            ++pos;
+        }
+
+        return pos != first;
+    }
+
+    bool parse_count(u32& min, u32& max)
+    {
+        ++pos; // {
+
+        if (not parse_number(min))
+        {
+            fail("bad {m,n}");
+            return false;
+        }
+
+        max = min;
+
+        if (at(','))
+        {
+            ++pos;
+            if (not parse_number(max))
+                max = unbounded;
+        }
+
+        if (not at('}'))
+        {
+            fail("bad {m,n}");
+            return false;
+        }
+
+        ++pos;
+
+        if (min > max_repeat or (max != unbounded and max > max_repeat))
+        {
+            fail(std::format("repeat counts above {}", max_repeat));
+            return false;
+        }
+
+        if (max < min)
+        {
+            fail("{m,n} with n < m");
+            return false;
+        }
+
+        return true;
+    }
+
+    Rx_Node parse_atom()
+    {
+        if (at('('))
+        {
+            ++pos;
+
+            if (text.substr(pos).starts_with("?:"))
+                pos += 2;
+
+            ++depth;
+            auto group = parse_alternate();
+            --depth;
+
+            if (not at(')'))
+                fail("missing )");
+            else
+                ++pos;
+
+            return group;
+        }
+
+        if (at('*') or at('+') or at('?') or at('{'))
+        {
+            fail("nothing to repeat");
+            return {};
+        }
+
+        if (at('.'))
+        {
+            ++pos;
+            return any_character();
+        }
+
+        if (at('['))
+            return parse_set();
+
+        if (at('\\'))
+            return parse_escape();
+
+        // NOTE: the match is always anchored, so explicit anchors are
+        // fine around each alternative and meaningless anywhere else
+        if (at('^'))
+        {
+            if (depth != 0 or pos != branch)
+                fail("^ not at the start of an alternative");
+
+            ++pos;
+            return {};
+        }
+
+        if (at('$'))
+        {
+            bool end = pos + 1 == text.size() or text[pos + 1] == '|';
+
+            if (depth != 0 or not end)
+                fail("$ not at the end of an alternative");
+
+            ++pos;
+            return {};
+        }
+
+        return literal(next_character());
+    }
+
+    // \d \w \s and their negations, nullopt for anything else
+    std::optional<Rx_Node> class_escape(char c)
+    {
+        auto node = make_node(Rx_Node::set);
+
+        switch (c)
+        {
+        case 'd': case 'D':
+            for (char d = '0'; d <= '9'; ++d)
+                node.ascii.set(u8(d));
+            break;
+
+        case 'w': case 'W':
+            for (char d = '0'; d <= '9'; ++d)
+                node.ascii.set(u8(d));
+            for (char l = 'a'; l <= 'z'; ++l)
+                node.ascii.set(u8(l)).set(u8(l - 'a' + 'A'));
+            node.ascii.set('_');
+            break;
+
+        case 's': case 'S':
+            for (char s : string_view(" \t\r\n\f\v"))
+                node.ascii.set(u8(s));
+            break;
+
+        default:
+            return std::nullopt;
+        }
+
+        node.negated = (c == 'D' or c == 'W' or c == 'S');
+        return node;
+    }
+
+    // the character an escape stands for, empty for the class escapes
+    str escaped_character(char c)
+    {
+        switch (c)
+        {
+        case 't': return "\t";
+        case 'n': return "\n";
+        case 'r': return "\r";
+        case 'f': return "\f";
+        case 'v': return "\v";
+        }
+
+        if ((c >= 'a' and c <= 'z') or (c >= 'A' and c <= 'Z') or (c >= '0' and c <= '9'))
+        {
+            fail(std::format("unknown escape \\{}", c));
+            return {};
+        }
+
+        return str(1, c);
+    }
+
+    Rx_Node parse_escape()
+    {
+        ++pos; // backslash
+
+        if (pos == text.size())
+        {
+            fail("trailing \\");
+            return {};
+        }
+
+        // an escaped non-ascii character is just that character
+        if (u8(text[pos]) >= 0x80)
+            return literal(next_character());
+
+        char c = text[pos++];
+
+        if (auto node = class_escape(c))
+            return std::move(*node);
+
+        auto character = escaped_character(c);
+
+        if (character.empty())
+            return {};
+
+        return literal(character);
+    }
+
+    Rx_Node parse_set()
+    {
+        ++pos; // [
+
+        auto node = make_node(Rx_Node::set);
+
+        if (at('^'))
+        {
+            ++pos;
+            node.negated = true;
+        }
+
+        bool first = true;
+
+        while (error.empty() and pos < text.size() and (first or not at(']')))
+        {
+            first = false;
+
+            if (at('\\') and pos + 1 < text.size() and u8(text[pos + 1]) >= 0x80)
+            {
+                ++pos;
+                add_to_set(node, next_character());
+                continue;
+            }
+
+            if (at('\\') and pos + 1 < text.size())
+            {
+                char c = text[pos + 1];
+                pos += 2;
+
+                if (auto escaped = class_escape(c))
+                {
+                    if (escaped->negated)
+                        fail("negated escape inside []");
+
+                    node.ascii |= escaped->ascii;
+                    continue;
+                }
+
+                auto character = escaped_character(c);
+
+                if (not character.empty())
+                    add_to_set(node, character);
+
+                continue;
+            }
+
+            auto lo = next_character();
+
+            if (at('-') and pos + 1 < text.size() and text[pos + 1] != ']')
+            {
+                ++pos;
+                auto hi = next_character();
+
+                if (lo.size() != 1 or hi.size() != 1 or u8(lo[0]) >= 0x80 or u8(hi[0]) >= 0x80)
+                {
+                    fail("ranges need ascii ends");
+                    break;
+                }
+
+                if (hi[0] < lo[0])
+                {
+                    fail("reversed range");
+                    break;
+                }
+
+                for (int c = lo[0]; c <= hi[0]; ++c)
+                    add_ascii(node, u8(c));
+
+                continue;
+            }
+
+            add_to_set(node, lo);
+        }
+
+        if (error.empty() and not at(']'))
+            fail("missing ]");
+        else if (error.empty())
+            ++pos;
+
+        if (node.negated and not node.multibyte.empty())
+            fail("negated sets only take ascii characters");
+
+        return node;
+    }
+
+    string_view text;
+    size_t pos {0};
+    size_t branch {0}; // where the current top level alternative starts
+    u32 depth {0}; // of ( )
+    bool fold {false};
+};
+
+// NOTE: thompson construction, a fragment is a start state plus the
+// dangling exits (state * 2 + which out) still to be connected.
+// Nested counts multiply, ((a{64}){64}){64} alone would be 262144
+// states, so building stops once the nfa grows past limit
+struct Nfa_Builder
+{
+    struct Fragment
+    {
+        u32 start;
+        vec<u32> outs;
+    };
+
+    using Nfa_State = Name_Matcher::Nfa_State;
+
+    vec<Nfa_State>& nfa;
+    size_t limit;
+    bool over {false};
+
+    u32 add(Nfa_State state)
+    {
+        nfa.push_back(state);
+        return u32(nfa.size() - 1);
+    }
+
+    void patch(const vec<u32>& outs, u32 target)
+    {
+        for (u32 out : outs)
+        {
+            auto& state = nfa[out >> 1];
+            (out & 1 ? state.out1 : state.out) = target;
+        }
+    }
+
+    Fragment empty()
+    {
+        u32 s = add({.kind = Nfa_State::split});
+        return {s, {s * 2}};
+    }
+
+    Fragment range(u8 lo, u8 hi)
+    {
+        u32 s = add({.kind = Nfa_State::range, .lo = lo, .hi = hi});
+        return {s, {s * 2}};
+    }
+
+    Fragment concat(Fragment a, Fragment b)
+    {
+        patch(a.outs, b.start);
+        return {a.start, std::move(b.outs)};
+    }
+
+    Fragment alternate(Fragment a, Fragment b)
+    {
+        u32 s = add({.kind = Nfa_State::split, .out = a.start, .out1 = b.start});
+        a.outs.insert(a.outs.end(), b.outs.begin(), b.outs.end());
+        return {s, std::move(a.outs)};
+    }
+
+    Fragment optional(Fragment a)
+    {
+        u32 s = add({.kind = Nfa_State::split, .out = a.start});
+        a.outs.push_back(s * 2 + 1);
+        return {s, std::move(a.outs)};
+    }
+
+    Fragment star(Fragment a)
+    {
+        u32 s = add({.kind = Nfa_State::split, .out = a.start});
+        patch(a.outs, s);
+        return {s, {s * 2 + 1}};
+    }
+
+    Fragment bytes(string_view text)
+    {
+        auto fragment = empty();
+
+        for (char c : text)
+            fragment = concat(std::move(fragment), range(u8(c), u8(c)));
+
+        return fragment;
+    }
+
+    // NOTE: lead byte ranges, not a validating decoder
+    Fragment any_multibyte()
+    {
+        auto tail = [this](u32 count)
+        {
+            auto fragment = empty();
+            for (u32 i = 0; i < count; ++i)
+                fragment = concat(std::move(fragment), range(0x80, 0xBF));
+            return fragment;
+        };
+
+        auto two = concat(range(0xC2, 0xDF), tail(1));
+        auto three = concat(range(0xE0, 0xEF), tail(2));
+        auto four = concat(range(0xF0, 0xF4), tail(3));
+
+        return alternate(std::move(two), alternate(std::move(three), std::move(four)));
+    }
+
+    Fragment set(const Rx_Node& node)
+    {
+        vec<Fragment> choices;
+
+        for (u32 c = 0; c < 128; ++c)
+        {
+            if (node.ascii.test(c) == node.negated)
+                continue;
+
+            u32 last = c;
+            while (last + 1 < 128 and node.ascii.test(last + 1) != node.negated)
+                ++last;
+
+            choices.push_back(range(u8(c), u8(last)));
+            c = last;
+        }
+
+        if (node.negated)
+            choices.push_back(any_multibyte());
+
+        for (const auto& character : node.multibyte)
+            choices.push_back(bytes(character));
+
+        // an empty set, a range nothing falls into
+        if (choices.empty())
+            return range(1, 0);
+
+        auto fragment = std::move(choices.back());
+        choices.pop_back();
+
+        while (not choices.empty())
+        {
+            fragment = alternate(std::move(choices.back()), std::move(fragment));
+            choices.pop_back();
+        }
+
+        return fragment;
+    }
+
+    Fragment build(const Rx_Node& node)
+    {
+        // the fragments are thrown away anyway
+        if (nfa.size() > limit)
+        {
+            over = true;
+            return {0, {}};
+        }
+
+        switch (node.kind)
+        {
+        case Rx_Node::empty:
+            return empty();
+
+        case Rx_Node::literal:
+            return bytes(node.bytes);
+
+        case Rx_Node::set:
+            return set(node);
+
+        case Rx_Node::concat:
+        {
+            auto fragment = empty();
+            for (const auto& child : node.children)
+                fragment = concat(std::move(fragment), build(child));
+            return fragment;
+        }
+
+        case Rx_Node::alternate:
+        {
+            auto fragment = build(node.children.back());
+            for (size_t i = node.children.size() - 1; i-- > 0;)
+                fragment = alternate(build(node.children[i]), std::move(fragment));
+            return fragment;
+        }
+
+        case Rx_Node::repeat:
+        {
+            const auto& child = node.children.front();
+            auto fragment = empty();
+
+            for (u32 i = 0; i < node.min; ++i)
+                fragment = concat(std::move(fragment), build(child));
+
+            if (node.max == unbounded)
+                return concat(std::move(fragment), star(build(child)));
+
+            for (u32 i = node.min; i < node.max; ++i)
+                fragment = concat(std::move(fragment), optional(build(child)));
+
+            return fragment;
+        }
+        }
+
+        return empty();
+    }
+};
+
+
+// public stuff
+
+std::optional<Name_Rule> parse_name_rule(string_view line)
+{
+    if (line.starts_with("glob:"))
+        return Name_Rule {Name_Rule_Kind::glob, str(line.substr(5))};
+
+    if (line.starts_with("re:"))
+        return Name_Rule {Name_Rule_Kind::regex, str(line.substr(3))};
+
+    return std::nullopt;
+}
+
+vec<Name_Rule_Error> Name_Matcher::compile(const vec<Name_Rule>& new_rules)
+{
+    vec<Name_Rule_Error> errors;
+
+    nfa.clear();
+    starts.clear();
+    rules = new_rules.size();
+
+    for (u32 i = 0; i < new_rules.size(); ++i)
+    {
+        const auto& rule = new_rules[i];
+        bool glob = rule.kind == Name_Rule_Kind::glob;
+
+        Rx_Parser parser(rule.pattern, glob);
+        auto root = glob ? parser.parse_glob() : parser.parse_regex();
+
+        if (not parser.error.empty())
+        {
+            errors.push_back({i, std::move(parser.error)});
+            continue;
+        }
+
+        size_t first = nfa.size();
+
+        Nfa_Builder builder {nfa, first + max_nfa_states};
+        auto fragment = builder.build(root);
+
+        if (builder.over)
+        {
+            nfa.resize(first);
+            errors.push_back({i, std::format("more than {} states, use smaller repeat counts",
+                                             max_nfa_states)});
+            continue;
+        }
+
+        builder.patch(fragment.outs, builder.add({.kind = Nfa_State::accept, .rule = i}));
+        starts.push_back(fragment.start);
+    }
+
+    reset_cache();
+
+    return errors;
+}
+
+std::optional<u32> Name_Matcher::match(string_view name)
+{
+    if (dfa.empty())
+        return std::nullopt;
+
+    u32 state = start_state;
+
+    for (char c : name)
+    {
+        u8 byte = u8(c);
+        u32 next = transitions[size_t(state) * 256 + byte];
+
+        if (next == no_state)
+            next = step(state, byte);
+
+        state = next;
+
+        if (state == dead)
+            return std::nullopt;
+    }
+
+    u32 rule = dfa[state].rule;
+
+    if (rule == no_rule)
+        return std::nullopt;
+
+    return rule;
+}
+
+size_t Name_Matcher::rule_count() const
+{
+    return rules;
+}
+
+size_t Name_Matcher::dfa_state_count() const
+{
+    return dfa.size();
+}
+
+void Name_Matcher::reset_cache()
+{
+    dfa.clear();
+    transitions.clear();
+    dfa_of_set.clear();
+    visited.assign(nfa.size(), 0);
+    generation = 0;
+
+    // NOTE: the dead state is the empty set and always comes first
+    add_dfa_state({});
+    std::fill_n(transitions.begin(), 256, dead);
+
+    vec<u32> set;
+    ++generation;
+
+    for (u32 state : starts)
+        closure(state, set);
+
+    start_state = set.empty() ? dead : add_dfa_state(std::move(set));
+}
+
+void Name_Matcher::closure(u32 state, vec<u32>& set)
+{
+    vec<u32> stack {state};
+
+    while (not stack.empty())
+    {
+        u32 s = stack.back();
+        stack.pop_back();
+
+        if (s == no_state or visited[s] == generation)
+            continue;
+
+        visited[s] = generation;
+        const auto& nfa_state = nfa[s];
+
+        if (nfa_state.kind == Nfa_State::split)
+        {
+            stack.push_back(nfa_state.out1);
+            stack.push_back(nfa_state.out);
+        }
+        else
+        {
+            set.push_back(s);
+        }
+    }
+}
+
+u32 Name_Matcher::add_dfa_state(vec<u32> set)
+{
+    std::sort(set.begin(), set.end());
+
+    if (auto it = dfa_of_set.find(set); it != dfa_of_set.end())
+        return it->second;
+
+    u32 rule = no_rule;
+
+    for (u32 s : set)
+    {
+        if (nfa[s].kind == Nfa_State::accept)
+            rule = std::min(rule, nfa[s].rule);
+    }
+
+    u32 id = u32(dfa.size());
+    dfa.push_back({set, rule});
+    transitions.resize(transitions.size() + 256, no_state);
+    dfa_of_set.emplace(std::move(set), id);
+
+    return id;
+}
+
+u32 Name_Matcher::step(u32 state, u8 byte)
+{
+    vec<u32> next;
+    ++generation;
+
+    for (u32 s : dfa[state].nfa)
+    {
+        const auto& nfa_state = nfa[s];
+
+        if (nfa_state.kind == Nfa_State::range and byte >= nfa_state.lo and byte <= nfa_state.hi)
+            closure(nfa_state.out, next);
+    }
+
+    // NOTE: rather than growing without bound the cache starts over,
+    // only the states names actually visit get built again
+    if (dfa.size() >= max_dfa_states)
+    {
+        reset_cache();
+        return add_dfa_state(std::move(next));
+    }
+
+    u32 target = add_dfa_state(std::move(next));
+    transitions[size_t(state) * 256 + byte] = target;
+
+    return target;
+}
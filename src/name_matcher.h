@@ -0,0 +1,98 @@
+#ifndef NAME_MATCHER_H
+#define NAME_MATCHER_H
+
+#include <map>
+
+#include "nic.h"
+
+// NOTE: a nic list line is a rule instead of a name when it starts with
+//   glob:<pattern>  '*' and '?' wildcards, case insensitive like Nic_Filter
+//   re:<pattern>    the whole name has to match, (?i) in front ignores case
+// Regexes know | ( ) (?: ) * + ? {m,n} . [a-z] [^...] \d \w \s and
+// escapes, ^ and $ only around a top level alternative. Case folding
+// goes by the utf-8 case tables of fold_case(), one character at a time
+enum class Name_Rule_Kind : u8
+{
+    glob,
+    regex,
+};
+
+struct Name_Rule
+{
+    Name_Rule_Kind kind {Name_Rule_Kind::glob};
+    str pattern;
+};
+
+// nullopt when the line is a plain interface name
+std::optional<Name_Rule> parse_name_rule(string_view line);
+
+struct Name_Rule_Error
+{
+    u32 rule {0}; // index in the rules given to compile()
+    str message;
+};
+
+// NOTE: all the rules compiled into one automaton, so a name is matched
+// against every rule in a single pass over its bytes. The DFA states are
+// only built the first time a name leads there, and the cache is thrown
+// away and rebuilt if it ever grows past max_dfa_states.
+// match() fills that cache, so one matcher must not be shared between
+// threads
+class Name_Matcher
+{
+public:
+    // NOTE: a rule that does not parse never matches, the others still do
+    vec<Name_Rule_Error> compile(const vec<Name_Rule>& rules);
+
+    // index of the first rule matching the whole name
+    std::optional<u32> match(string_view name);
+
+    size_t rule_count() const;
+    size_t dfa_state_count() const;
+
+private:
+    struct Nfa_State
+    {
+        enum Kind : u8 { range, split, accept };
+
+        Kind kind {split};
+        u8 lo {0};
+        u8 hi {0};
+        u32 out {no_state};
+        u32 out1 {no_state};
+        u32 rule {0};
+    };
+
+    struct Dfa_State
+    {
+        vec<u32> nfa; // sorted, range and accept states only
+        u32 rule {no_rule};
+    };
+
+    static constexpr u32 no_state = ~u32(0);
+    static constexpr u32 no_rule = ~u32(0);
+    static constexpr u32 dead = 0;
+    static constexpr size_t max_dfa_states = 4096;
+    static constexpr size_t max_nfa_states = 16384; // per rule
+
+    friend struct Nfa_Builder;
+
+    void reset_cache();
+    void closure(u32 state, vec<u32>& set);
+    u32 add_dfa_state(vec<u32> set);
+    u32 step(u32 state, u8 byte);
+
+    vec<Nfa_State> nfa;
+    vec<u32> starts;
+    size_t rules {0};
+
+    vec<Dfa_State> dfa;
+    u32 start_state {dead};
+    vec<u32> transitions; // 256 per dfa state, no_state until computed
+    std::map<vec<u32>, u32> dfa_of_set;
+
+    vec<u32> visited; // generation marks for closure()
+    u32 generation {0};
+};
+
+#endif // NAME_MATCHER_H
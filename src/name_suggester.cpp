@@ -0,0 +1,260 @@
+#include "name_suggester.h"
+
+#include "name_index.h"
+#include "nic_private.h"
+#include "utf8.h"
+
+#include <algorithm>
+#include <array>
+
+static vec<u32> to_code_points(str_cref text)
+{
+    vec<u32> code_points;
+    code_points.reserve(text.size());
+
+    auto* it = reinterpret_cast<const utf8_int8_t*>(text.c_str());
+
+    // NOTE: stops at the first '\0'
+    while (*it != '\0')
+    {
+        utf8_int32_t code_point = 0;
+        it = utf8codepoint(it, &code_point);
+        code_points.push_back(static_cast<u32>(code_point));
+    }
+
+    return code_points;
+}
+
+// NOTE: the query side of Myers' algorithm (Hyyro's formulation for
+// the global distance). The pattern is turned into one bit mask per
+// character, then every text character updates a whole column of the
+// dynamic programming matrix with a handful of word operations.
+// Patterns longer than a word fall back to the plain row by row matrix
+class Myers_Pattern
+{
+public:
+    explicit Myers_Pattern(const vec<u32>& pattern)
+        : pattern(pattern)
+    {
+        if (pattern.size() > 64)
+            return;
+
+        for (size_t i = 0; i < pattern.size(); ++i)
+        {
+            u32 c = pattern[i];
+            u64 bit = u64(1) << i;
+
+            if (c < ascii.size())
+            {
+                ascii[c] |= bit;
+                continue;
+            }
+
+            auto it = std::find_if(other.begin(), other.end(),
+                                   [c](const auto& entry) { return entry.first == c; });
+
+            if (it == other.end())
+                other.push_back({c, bit});
+            else
+                it->second |= bit;
+        }
+    }
+
+    u32 distance(const vec<u32>& text) const
+    {
+        const u32 m = static_cast<u32>(pattern.size());
+
+        if (m == 0)
+            return static_cast<u32>(text.size());
+
+        if (m > 64)
+            return matrix_distance(text);
+
+        const u64 high = u64(1) << (m - 1);
+
+        u64 pv = m == 64 ? ~u64(0) : (u64(1) << m) - 1;
+        u64 mv = 0;
+        u32 score = m;
+
+        for (u32 c : text)
+        {
+            u64 eq = equal(c);
+            u64 xv = eq | mv;
+            u64 xh = (((eq & pv) + pv) ^ pv) | eq;
+            u64 ph = mv | ~(xh | pv);
+            u64 mh = pv & xh;
+
+            if (ph & high)
+                ++score;
+            else if (mh & high)
+                --score;
+
+            // the first row of the matrix grows by one per text character
+            ph = (ph << 1) | 1;
+            mh = mh << 1;
+            pv = mh | ~(xv | ph);
+            mv = ph & xv;
+        }
+
+        return score;
+    }
+
+private:
+    u64 equal(u32 c) const
+    {
+        if (c < ascii.size())
+            return ascii[c];
+
+        for (const auto& [code_point, bits] : other)
+        {
+            if (code_point == c)
+                return bits;
+        }
+
+        return 0;
+    }
+
+    u32 matrix_distance(const vec<u32>& text) const
+    {
+        vec<u32> row(pattern.size() + 1);
+
+        for (size_t i = 0; i < row.size(); ++i)
+            row[i] = static_cast<u32>(i);
+
+        for (size_t j = 0; j < text.size(); ++j)
+        {
+            u32 diagonal = row[0];
+            row[0] = static_cast<u32>(j + 1);
+
+            for (size_t i = 1; i < row.size(); ++i)
+            {
+                u32 above = row[i];
+                u32 substitution = diagonal + (pattern[i - 1] == text[j] ? 0 : 1);
+                row[i] = std::min({above + 1, row[i - 1] + 1, substitution});
+                diagonal = above;
+            }
+        }
+
+        return row.back();
+    }
+
+    vec<u32> pattern;
+    std::array<u64, 128> ascii {};
+    vec<std::pair<u32, u64>> other;
+};
+
+
+// public stuff
+
+u32 edit_distance(str_cref a, str_cref b)
+{
+    return Myers_Pattern(to_code_points(a)).distance(to_code_points(b));
+}
+
+void Name_Suggester::build(const vec<shared<Interface>>& interfaces)
+{
+    nodes.clear();
+    names.clear();
+
+    nodes.reserve(interfaces.size());
+    names.reserve(interfaces.size());
+
+    for (const auto& nic : interfaces)
+    {
+        u32 name = static_cast<u32>(names.size());
+        names.push_back(nic->name);
+
+        auto key = to_code_points(nic->match_key);
+
+        if (nodes.empty())
+        {
+            nodes.push_back({std::move(key), {name}, {}});
+            continue;
+        }
+
+        // NOTE: walk down along the edge labelled with the distance to
+        // each node until there is no such edge yet
+        Myers_Pattern pattern(key);
+        u32 node = 0;
+
+        while (true)
+        {
+            u32 distance = pattern.distance(nodes[node].key);
+
+            if (distance == 0)
+            {
+                nodes[node].names.push_back(name);
+                break;
+            }
+
+            auto& children = nodes[node].children;
+            auto it = std::find_if(children.begin(), children.end(),
+                                   [distance](const auto& child) { return child.first == distance; });
+
+            if (it != children.end())
+            {
+                node = it->second;
+                continue;
+            }
+
+            children.push_back({distance, static_cast<u32>(nodes.size())});
+            nodes.push_back({std::move(key), {name}, {}});
+            break;
+        }
+    }
+}
+
+vec<Name_Suggestion> Name_Suggester::suggest(str_cref line, size_t max_results) const
+{
+    vec<Name_Suggestion> suggestions;
+
+    if (nodes.empty() or max_results == 0)
+        return suggestions;
+
+    auto key = to_code_points(normalize_name(line));
+    Myers_Pattern pattern(key);
+
+    const u32 max_distance = std::clamp<u32>(static_cast<u32>(key.size()) / 3, 1, 4);
+
+    vec<u32> stack {0};
+
+    while (not stack.empty())
+    {
+        const auto& node = nodes[stack.back()];
+        stack.pop_back();
+
+        u32 distance = pattern.distance(node.key);
+
+        if (distance <= max_distance)
+        {
+            for (u32 name : node.names)
+                suggestions.push_back({names[name], distance});
+        }
+
+        // NOTE: anything under an edge further than max_distance from
+        // the one to the query cannot be close enough
+        for (const auto& [edge, child] : node.children)
+        {
+            if (edge + max_distance >= distance and edge <= distance + max_distance)
+                stack.push_back(child);
+        }
+    }
+
+    std::sort(suggestions.begin(), suggestions.end(),
+              [](const Name_Suggestion& a, const Name_Suggestion& b)
+              {
+                  if (a.distance != b.distance)
+                      return a.distance < b.distance;
+                  return a.name < b.name;
+              });
+
+    if (suggestions.size() > max_results)
+        suggestions.resize(max_results);
+
+    return suggestions;
+}
+
+size_t Name_Suggester::size() const
+{
+    return names.size();
+}
@@ -0,0 +1,43 @@
+#ifndef NAME_SUGGESTER_H
+#define NAME_SUGGESTER_H
+
+#include "nic.h"
+
+// NOTE: levenshtein distance counted in code points
+u32 edit_distance(str_cref a, str_cref b);
+
+struct Name_Suggestion
+{
+    str name;
+    u32 distance {0}; // between the normalized forms
+};
+
+// NOTE: "did you mean" for nic list lines that found no interface.
+// Names are compared normalized (see normalize_name()) and kept in a
+// BK-tree, so a query only measures the few names the triangle
+// inequality cannot rule out, each one with Myers' bit-parallel
+// algorithm. Lines more than a third of their length away from every
+// name (at least 1, at most 4 edits) get no suggestion
+class Name_Suggester
+{
+public:
+    void build(const vec<shared<Interface>>& interfaces);
+
+    // closest first, ties in name order
+    vec<Name_Suggestion> suggest(str_cref line, size_t max_results = 3) const;
+
+    size_t size() const;
+
+private:
+    struct Node
+    {
+        vec<u32> key; // code points of the normalized name
+        vec<u32> names; // every interface normalizing to key
+        vec<std::pair<u32, u32>> children; // distance, node
+    };
+
+    vec<Node> nodes;
+    vec<str> names;
+};
+
+#endif // NAME_SUGGESTER_H
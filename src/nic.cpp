@@ -1,38 +1,25 @@
-#include "nic.h"
+#include "nic_private.h"
 
 #pragma comment(lib, "IPHLPAPI.lib")
 #pragma comment(lib, "Ws2_32.lib")
 
-#define WIN32_LEAN_AND_MEAN
-#define NOMINMAX
-#include <windows.h>
-#include <winsock2.h>
-#include <ws2ipdef.h>
-#include <ws2tcpip.h> // for inet_ntop function
-#include <iphlpapi.h>
-#include <shellapi.h>
-
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cwctype>
+#include <mutex>
+#include <optional>
 #include <sstream>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 
-#include "utf8.h"
-
+#include "metrics.h"
+#include "name_index.h"
+#include "name_matcher.h"
+#include "trace.h"
 
-struct Interface
-{
-    // NOTE: all std::string are utf-8 encoded
-    str name;
-    str description;
-    str ip;
-    u32 subnet {0};
-    str gateway;
-    str dns;
-    str dns_suff;
-    u32 metric {0};
-    bool automatic_metric {false};
-    bool connected {false};
-    IF_LUID luid {};
-    IF_INDEX index {};
-};
 
 struct Heap_Deleter
 {
@@ -45,15 +32,6 @@ void Heap_Deleter::operator()(void *mem) const
         HeapFree(GetProcessHeap(), NULL, mem);
 }
 
-struct WSA_Startup
-{
-    WSA_Startup(WORD version);
-    ~WSA_Startup();
-
-    WSADATA wsa_data {};
-    int res {};
-};
-
 WSA_Startup::WSA_Startup(WORD version)
 {
     res = WSAStartup(version, &wsa_data);
@@ -65,168 +43,692 @@ WSA_Startup::~WSA_Startup()
     WSACleanup();
 }
 
+Compartment_Scope::Compartment_Scope(NET_IF_COMPARTMENT_ID compartment)
+{
+    previous = GetCurrentThreadCompartmentId();
+
+    if (compartment == NET_IF_COMPARTMENT_ID_UNSPECIFIED or
+        compartment == previous)
+    {
+        return;
+    }
+
+    res = SetCurrentThreadCompartmentId(compartment);
+    switched = res == NO_ERROR;
+}
+
+Compartment_Scope::~Compartment_Scope()
+{
+    // we ignore return code here
+    if (switched)
+        SetCurrentThreadCompartmentId(previous);
+}
+
+Nic_Watch::~Nic_Watch()
+{
+    // NOTE: blocks until a callback that is already running has returned
+    if (handle)
+        CancelMibChangeNotify2(handle);
+}
+
+static void NETIOAPI_API_ on_ip_interface_change(PVOID context,
+                                                 PMIB_IPINTERFACE_ROW row,
+                                                 MIB_NOTIFICATION_TYPE type)
+{
+    // the initial notification has no row
+    if (row == nullptr or type == MibInitialNotification)
+        return;
+
+    auto* watch = static_cast<Nic_Watch*>(context);
+
+    Nic_Change change {};
+    change.luid = row->InterfaceLuid.Value;
+    change.family = row->Family;
+    change.metric = row->Metric;
+    change.automatic_metric = row->UseAutomaticMetric;
+    change.connected = row->Connected;
+
+    switch (type)
+    {
+    case MibAddInstance: change.kind = Nic_Change_Kind::added; break;
+    case MibDeleteInstance: change.kind = Nic_Change_Kind::removed; break;
+    default: change.kind = Nic_Change_Kind::changed; break;
+    }
+
+    watch->callback(change);
+}
+
+static Metric_Write make_metric_write(const shared<Interface>& nic, u32 new_metric)
+{
+    Metric_Write write {nic, new_metric};
 
-// forward declaration of private stuff
+    if (nic->ipv4_enabled)
+        write.old_metric = nic->metric;
 
-str to_UTF8(wstr_cref wide_str);
-wstr to_wide(str_cref utf8_str);
-str last_error_as_string(DWORD last_error);
-void update_nic_metric_for_luid(str_cref interface_name,
-                                IF_LUID luid,
-                                ULONG new_metric,
-                                bool automatic_metric);
-vec<str> split_string_by_newline(str_cref text);
+    if (nic->ipv6_enabled)
+        write.old_metric_v6 = nic->metric_v6;
+
+    write.disable_automatic =
+        (nic->ipv4_enabled and nic->automatic_metric) or
+        (nic->ipv6_enabled and nic->automatic_metric_v6);
+
+    return write;
+}
 
 
 // public stuff
 
-vec<shared<Interface>> collect_nic_info()
+Nic_Result<vec<shared<Interface>>> collect_nic_info(const Nic_Filter& filter)
+{
+    vec<shared<Interface>> interfaces;
+
+    auto res = collect_nic_info(
+        filter,
+        [&interfaces](shared<Interface> nic)
+        {
+            interfaces.push_back(std::move(nic));
+            return true;
+        });
+
+    if (not res)
+        return std::unexpected(res.error());
+
+    return interfaces;
+}
+
+Nic_Result<void> collect_nic_info(const Nic_Filter& filter, const Nic_Sink& sink)
 {
+    QTNIC_TRACE_SCOPE("collect_nic_info");
+    Op_Timer timer(Nic_Op::enumerate);
+
     ULONG buffer_size = 0;
     ULONG adapters_flags =
         GAA_FLAG_INCLUDE_WINS_INFO |
         GAA_FLAG_INCLUDE_PREFIX |
         GAA_FLAG_INCLUDE_GATEWAYS;
 
-    GetAdaptersAddresses(AF_INET, adapters_flags, NULL, NULL, &buffer_size);
+    // NOTE: AF_UNSPEC gives us both families in a single pass
+    {
+        QTNIC_TRACE_SCOPE("GetAdaptersAddresses (size)");
+        GetAdaptersAddresses(AF_UNSPEC, adapters_flags, NULL, NULL, &buffer_size);
+    }
 
     auto* mem_ = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, buffer_size);
     std::unique_ptr<void, Heap_Deleter> mem(mem_);
 
     if (not mem)
     {
-        throw std::format("[ERROR] cannot allocate memory!");
+        timer.fail();
+        return std::unexpected(Nic_Error {Nic_Errc::out_of_memory});
     }
 
-    DWORD result = GetAdaptersAddresses(
-        AF_INET,
-        adapters_flags,
-        NULL,
-        (IP_ADAPTER_ADDRESSES*)mem.get(), &buffer_size);
+    DWORD result = NO_ERROR;
+
+    {
+        QTNIC_TRACE_SCOPE("GetAdaptersAddresses");
+        result = GetAdaptersAddresses(
+            AF_UNSPEC,
+            adapters_flags,
+            NULL,
+            (IP_ADAPTER_ADDRESSES*)mem.get(), &buffer_size);
+    }
 
     if (result != NO_ERROR)
     {
-        throw std::format("[ERROR] cannot get adapters addresses: {}",
-                          last_error_as_string(result));
+        timer.fail();
+        return std::unexpected(Nic_Error {Nic_Errc::get_adapters_addresses, result});
     }
 
-    vec<shared<Interface>> interfaces;
+    auto compartment = GetCurrentThreadCompartmentId();
+
+    // NOTE: converted once, adapters are matched on their wide name so
+    // the rejected ones never go through to_UTF8
+    wstr name_glob = filter.name_glob.empty() ? wstr() : to_wide(filter.name_glob);
 
     IP_ADAPTER_ADDRESSES* adapter = (IP_ADAPTER_ADDRESSES*)mem.get();
 
-    while (adapter != nullptr)
+    for (; adapter != nullptr; adapter = adapter->Next)
     {
-        Interface itf {};
+        if (not adapter_passes_filter(adapter, filter, name_glob))
+        {
+            continue;
+        }
+
+        Interface itf = parse_adapter(adapter);
+        itf.compartment = compartment;
+
+        if (itf.ipv4_enabled)
+        {
+            MIB_IPINTERFACE_ROW interface_row {};
+            interface_row.Family = AF_INET;
+            interface_row.InterfaceLuid = adapter->Luid;
+
+            result = get_ip_interface_entry(&interface_row);
+
+            if (result != NO_ERROR)
+            {
+                timer.fail();
+                return std::unexpected(Nic_Error {
+                    .code = Nic_Errc::get_ip_interface_entry,
+                    .os_error = result,
+                    .family = AF_INET});
+            }
+
+            itf.automatic_metric = interface_row.UseAutomaticMetric;
+        }
 
-        itf.name = to_UTF8(adapter->FriendlyName);
-        itf.description = to_UTF8(adapter->Description);
-        itf.connected = adapter->OperStatus == IfOperStatusUp;
-        itf.dns_suff = to_UTF8(adapter->DnsSuffix);
-        itf.metric = adapter->Ipv4Metric;
-        itf.index = adapter->IfIndex;
-        itf.luid = adapter->Luid;
+        if (itf.ipv6_enabled)
+        {
+            MIB_IPINTERFACE_ROW interface_row {};
+            interface_row.Family = AF_INET6;
+            interface_row.InterfaceLuid = adapter->Luid;
 
-        MIB_IPINTERFACE_ROW interface_row {};
-        interface_row.Family = AF_INET;
-        interface_row.InterfaceLuid = adapter->Luid;
+            result = get_ip_interface_entry(&interface_row);
 
-        result = GetIpInterfaceEntry(&interface_row);
+            if (result == ERROR_NOT_FOUND)
+            {
+                // ipv6 unbound from this adapter, nothing to order
+                itf.ipv6_enabled = false;
+            }
+            else if (result != NO_ERROR)
+            {
+                timer.fail();
+                return std::unexpected(Nic_Error {
+                    .code = Nic_Errc::get_ip_interface_entry,
+                    .os_error = result,
+                    .family = AF_INET6});
+            }
+            else
+            {
+                itf.automatic_metric_v6 = interface_row.UseAutomaticMetric;
+            }
+        }
 
-        if (result != NO_ERROR)
+        if (not sink(std::make_shared<Interface>(std::move(itf))))
         {
-            throw std::format("[ERROR] GetIpInterfaceEntry failed: {}",
-                              last_error_as_string(result));
+            // caller has seen enough
+            break;
         }
+    }
+
+    return {};
+}
+
+Nic_Result<vec<shared<Interface>>> collect_nic_info(const vec<u32>& compartments,
+                                                    const Nic_Filter& filter)
+{
+    const size_t count = compartments.size();
 
-        itf.automatic_metric = interface_row.UseAutomaticMetric;
+    vec<vec<shared<Interface>>> results(count);
+    vec<std::optional<Nic_Error>> errors(count);
+    std::atomic<size_t> next {0};
 
-        // get all the IPs
-        for (IP_ADAPTER_UNICAST_ADDRESS_LH* unicast_addr = adapter->FirstUnicastAddress;
-             unicast_addr != nullptr;
-             unicast_addr = unicast_addr->Next)
+    auto worker = [&]()
+    {
+        for (size_t i = next++; i < count; i = next++)
         {
-            sockaddr_in* sockaddr_ipv4 = reinterpret_cast<sockaddr_in*>(unicast_addr->Address.lpSockaddr);
-            wchar_t ip_str[INET_ADDRSTRLEN] {};
-            InetNtopW(AF_INET, &(sockaddr_ipv4->sin_addr), ip_str, INET_ADDRSTRLEN);
+            try
+            {
+                Compartment_Scope scope(compartments[i]);
+
+                if (scope.res != NO_ERROR)
+                {
+                    errors[i] = Nic_Error {
+                        .code = Nic_Errc::enter_compartment,
+                        .os_error = scope.res,
+                        .compartment = compartments[i]};
+                    continue;
+                }
+
+                auto result = collect_nic_info(filter);
+
+                if (not result)
+                {
+                    errors[i] = result.error();
+                    errors[i]->compartment = compartments[i];
+                    continue;
+                }
+
+                results[i] = std::move(*result);
+            }
+            catch (const std::bad_alloc&)
+            {
+                errors[i] = Nic_Error {
+                    .code = Nic_Errc::out_of_memory,
+                    .compartment = compartments[i]};
+            }
+        }
+    };
 
-            itf.ip.append(to_UTF8(ip_str)).append(" ");
-            itf.subnet = unicast_addr->OnLinkPrefixLength;
+    {
+        size_t worker_count = std::min<size_t>(
+            count, std::max(1u, std::thread::hardware_concurrency()));
+
+        vec<std::jthread> pool;
+        pool.reserve(worker_count);
+
+        for (size_t i = 0; i < worker_count; ++i)
+            pool.emplace_back(worker);
+    }
+
+    for (const auto& error : errors)
+    {
+        if (error)
+            return std::unexpected(*error);
+    }
+
+    size_t total = 0;
+    for (const auto& result : results)
+        total += result.size();
+
+    vec<shared<Interface>> interfaces;
+    interfaces.reserve(total);
+
+    for (auto& result : results)
+    {
+        interfaces.insert(interfaces.end(),
+                          std::make_move_iterator(result.begin()),
+                          std::make_move_iterator(result.end()));
+    }
+
+    return interfaces;
+}
+
+Nic_Result<void> collect_nic_info(const vec<u32>& compartments,
+                                  const Nic_Filter& filter,
+                                  const Nic_Sink& sink)
+{
+    bool stopped = false;
+
+    auto forward = [&sink, &stopped](shared<Interface> nic)
+    {
+        stopped = not sink(std::move(nic));
+        return not stopped;
+    };
+
+    for (u32 compartment : compartments)
+    {
+        Compartment_Scope scope(compartment);
+
+        if (scope.res != NO_ERROR)
+        {
+            return std::unexpected(Nic_Error {
+                .code = Nic_Errc::enter_compartment,
+                .os_error = scope.res,
+                .compartment = compartment});
         }
 
-        // get all the Gateway
-        for (IP_ADAPTER_GATEWAY_ADDRESS_LH* gateway_addr = adapter->FirstGatewayAddress;
-             gateway_addr != nullptr;
-             gateway_addr = gateway_addr->Next)
+        if (auto res = collect_nic_info(filter, forward); not res)
+        {
+            auto error = res.error();
+            error.compartment = compartment;
+            return std::unexpected(error);
+        }
+
+        if (stopped)
+            break;
+    }
+
+    return {};
+}
+
+vec<u32> list_network_compartments(u32 max_id)
+{
+    vec<u32> compartments;
+
+    // NOTE: there is no api to list them, so we probe the ids from a
+    // throwaway thread and leave the caller's compartment alone
+    std::jthread prober([&compartments, max_id]()
+    {
+        for (u32 id = NET_IF_COMPARTMENT_ID_PRIMARY; id <= max_id; ++id)
         {
-            sockaddr_in* sockaddr_ipv4 = reinterpret_cast<sockaddr_in*>(gateway_addr->Address.lpSockaddr);
-            wchar_t gateway_str[INET_ADDRSTRLEN] {};
-            InetNtopW(AF_INET, &sockaddr_ipv4->sin_addr, gateway_str, INET_ADDRSTRLEN);
+            if (SetCurrentThreadCompartmentId(id) == NO_ERROR)
+                compartments.push_back(id);
+        }
+    });
+
+    prober.join();
+
+    return compartments;
+}
+
+Metric_Plan plan_nic_metric(const vec<shared<Interface>>& interfaces,
+                            str_cref nic_list,
+                            Name_Match match)
+{
+    QTNIC_TRACE_SCOPE("plan_nic_metric");
+    Op_Timer timer(Nic_Op::match);
+
+    Metric_Plan plan {};
+
+    // NOTE: names are hashed once, every line is then a single lookup
+    // instead of a walk over all the interfaces. The first interface
+    // with a given name wins, like the old linear search.
+    // Loose matching hashes the keys made at enumeration instead, only
+    // the lines have to be normalized here
+    bool loose = match == Name_Match::loose;
+
+    std::unordered_map<string_view, const shared<Interface>*> by_name;
+    by_name.reserve(interfaces.size());
+
+    for (const auto& nic : interfaces)
+        by_name.emplace(loose ? nic->match_key : nic->name, &nic);
 
-            itf.gateway.append(to_UTF8(gateway_str)).append(" ");
+    constexpr u32 no_rule = ~u32(0);
+
+    struct Plan_Line
+    {
+        string_view text;
+        const shared<Interface>* nic {nullptr}; // a name that was found
+        u32 rule {no_rule};                     // or a glob: / re: line
+    };
+
+    vec<Plan_Line> lines;
+    vec<Name_Rule> rules;
+
+    for_each_line(nic_list, [&](string_view line)
+    {
+        if (auto rule = parse_name_rule(line))
+        {
+            lines.push_back({line, nullptr, u32(rules.size())});
+            rules.push_back(std::move(*rule));
+            return;
         }
 
-        // get all the DNS
-        for (IP_ADAPTER_DNS_SERVER_ADDRESS_XP* dns_addr = adapter->FirstDnsServerAddress;
-             dns_addr != nullptr;
-             dns_addr = dns_addr->Next)
+        auto it = loose ? by_name.find(normalize_name(str(line))) : by_name.find(line);
+        lines.push_back({line, it == by_name.end() ? nullptr : it->second});
+    });
+
+    // NOTE: a name wins over every rule wherever it is in the list, rules
+    // share out what nobody named, first matching rule first, each in
+    // enumeration order. All of them are compiled into one automaton so
+    // every interface is matched in a single pass over its name
+    vec<vec<const shared<Interface>*>> matched(rules.size());
+
+    if (not rules.empty())
+    {
+        std::unordered_set<const Interface*> named;
+
+        for (const auto& line : lines)
         {
-            sockaddr_in* sockaddr_ipv4 = reinterpret_cast<sockaddr_in*>(dns_addr->Address.lpSockaddr);
-            wchar_t dns_str[INET_ADDRSTRLEN] {};
-            InetNtopW(AF_INET, &sockaddr_ipv4->sin_addr, dns_str, INET_ADDRSTRLEN);
+            if (line.nic)
+                named.insert(line.nic->get());
+        }
+
+        Name_Matcher matcher;
 
-            itf.dns.append(to_UTF8(dns_str)).append(" ");
+        for (auto& error : matcher.compile(rules))
+        {
+            auto prefix = rules[error.rule].kind == Name_Rule_Kind::glob ? "glob:" : "re:";
+            plan.errors.push_back(
+                std::format("{}{}: {}", prefix, rules[error.rule].pattern, error.message));
         }
 
-        interfaces.push_back(std::make_shared<Interface>(itf));
+        for (const auto& nic : interfaces)
+        {
+            if (named.contains(nic.get()))
+                continue;
 
-        adapter = adapter->Next;
+            if (auto rule = matcher.match(nic->name))
+                matched[*rule].push_back(&nic);
+        }
     }
 
-    return interfaces;
+    u32 pos = 1;
+    for (const auto& line : lines)
+    {
+        if (line.rule != no_rule and not matched[line.rule].empty())
+        {
+            for (const auto* nic : matched[line.rule])
+                plan.writes.push_back(make_metric_write(*nic, (pos++) * 10));
+        }
+        else if (line.nic)
+        {
+            plan.writes.push_back(make_metric_write(*line.nic, (pos++) * 10));
+        }
+        else
+        {
+            ++plan.skipped;
+
+            if (line.rule == no_rule and not line.text.empty())
+                plan.unmatched.emplace_back(line.text);
+        }
+    }
+
+    return plan;
 }
 
-u32 update_nic_metric(const vec<shared<Interface>> &interfaces,
-                       str_cref nic_list)
+Metric_Plan plan_nic_metric(const vec<shared<Interface>>& ordered_interfaces)
 {
-    u32 skipped = 0;
+    Metric_Plan plan {};
+    plan_nic_metric(ordered_interfaces, plan);
+    return plan;
+}
 
-    auto lines = split_string_by_newline(nic_list);
+void plan_nic_metric(const vec<shared<Interface>>& ordered_interfaces, Metric_Plan& plan)
+{
+    plan.writes.clear();
+    plan.writes.reserve(ordered_interfaces.size());
+    plan.skipped = 0;
+    plan.errors.clear();
+    plan.unmatched.clear();
 
     u32 pos = 1;
-    for (str_cref line : lines)
+    for (const auto& nic : ordered_interfaces)
+    {
+        plan.writes.push_back(make_metric_write(nic, (pos++) * 10));
+    }
+}
+
+u32 changed_families(const Metric_Write& write)
+{
+    const auto& nic = write.nic;
+    u32 families = 0;
+
+    if (nic->ipv4_enabled and (nic->metric != write.new_metric or nic->automatic_metric))
+        ++families;
+
+    if (nic->ipv6_enabled and (nic->metric_v6 != write.new_metric or nic->automatic_metric_v6))
+        ++families;
+
+    return families;
+}
+
+Plan_Cost estimate_plan_cost(const Metric_Plan& plan)
+{
+    // NOTE: a ballpark until this process has made a real write
+    constexpr u64 default_write_ns = 2'000'000;
+
+    Plan_Cost cost {};
+
+    for (const auto& write : plan.writes)
+        cost.writes += changed_families(write);
+
+    auto stats = nic_op_stats();
+    const auto& set = stats[static_cast<size_t>(Nic_Op::set_ip_interface_entry)];
+
+    cost.measured = set.calls != 0;
+    cost.per_write_ns = cost.measured ? set.p50_ns : default_write_ns;
+    cost.estimated_ns = cost.per_write_ns * cost.writes;
+
+    return cost;
+}
+
+Nic_Result<void> apply_nic_metric_plan(const Metric_Plan& plan)
+{
+    QTNIC_TRACE_SCOPE("apply_nic_metric_plan");
+    Op_Timer timer(Nic_Op::apply);
+
+    for (const auto& write : plan.writes)
     {
-        auto* target_name = line.data();
+        Compartment_Scope scope(write.nic->compartment);
+
+        if (scope.res != NO_ERROR)
+        {
+            timer.fail();
+            return std::unexpected(Nic_Error {
+                .code = Nic_Errc::enter_compartment,
+                .os_error = scope.res,
+                .compartment = write.nic->compartment,
+                .nic = write.nic});
+        }
 
-        auto it = std::find_if(
-            interfaces.begin(),
-            interfaces.end(),
-            [target_name](const shared<Interface>& itf)
+        // NOTE: both families in the same pass, the order is the same
+        // for both of them
+        if (write.nic->ipv4_enabled)
+        {
+            auto res = update_nic_metric_for_luid(write.nic,
+                                                  AF_INET,
+                                                  write.new_metric,
+                                                  write.nic->automatic_metric);
+            if (not res)
             {
-                auto* src1 = reinterpret_cast<const utf8_int8_t*>(itf->name.c_str());
-                auto* src2 = reinterpret_cast<const utf8_int8_t*>(target_name);
-                return utf8cmp(src1, src2) == 0;
+                timer.fail();
+                return res;
             }
-        );
+        }
 
-        if (it == interfaces.end())
+        if (write.nic->ipv6_enabled)
         {
-            ++skipped;
-            continue;
+            auto res = update_nic_metric_for_luid(write.nic,
+                                                  AF_INET6,
+                                                  write.new_metric,
+                                                  write.nic->automatic_metric_v6);
+            if (not res)
+            {
+                timer.fail();
+                return res;
+            }
         }
+    }
 
-        ULONG new_metric = (pos++) * 10;
+    return {};
+}
+
+Nic_Result<u32> update_nic_metric(const vec<shared<Interface>> &interfaces,
+                                  str_cref nic_list,
+                                  Name_Match match)
+{
+    auto plan = plan_nic_metric(interfaces, nic_list, match);
+
+    auto res = apply_nic_metric_plan(plan);
+
+    if (not res)
+        return std::unexpected(res.error());
+
+    return plan.skipped;
+}
 
-        update_nic_metric_for_luid(target_name,
-                                   (*it)->luid,
-                                   new_metric,
-                                   (*it)->automatic_metric);
+
+Nic_Result<vec<Profile_Step>> apply_nic_profiles(const vec<shared<Interface>>& interfaces,
+                                                 const vec<Nic_Profile>& profiles,
+                                                 Name_Match match)
+{
+    using Clock = std::chrono::steady_clock;
+
+    Op_Timer timer(Nic_Op::apply);
+
+    // NOTE: what the kernel holds after our writes, so nothing is read
+    // back between profiles
+    struct Family_State
+    {
+        u32 metric {0};
+        bool automatic_metric {false};
+    };
+
+    std::unordered_map<const Interface*, std::array<Family_State, 2>> state;
+    state.reserve(interfaces.size());
+
+    for (const auto& nic : interfaces)
+    {
+        state[nic.get()] = {{
+            {nic->metric, nic->automatic_metric},
+            {nic->metric_v6, nic->automatic_metric_v6}}};
     }
 
-    return skipped;
+    vec<Profile_Step> steps;
+    steps.reserve(profiles.size());
+
+    for (const auto& profile : profiles)
+    {
+        auto started = Clock::now();
+        auto plan = plan_nic_metric(interfaces, profile.nic_list, match);
+
+        Profile_Step step {};
+        step.name = profile.name;
+        step.skipped = plan.skipped;
+        step.unmatched = std::move(plan.unmatched);
+
+        for (const auto& write : plan.writes)
+        {
+            auto& families = state[write.nic.get()];
+
+            auto needs_write = [&write](const Family_State& family)
+            {
+                return family.metric != write.new_metric or family.automatic_metric;
+            };
+
+            bool v4 = write.nic->ipv4_enabled and needs_write(families[0]);
+            bool v6 = write.nic->ipv6_enabled and needs_write(families[1]);
+
+            if (not v4 and not v6)
+                continue;
+
+            Compartment_Scope scope(write.nic->compartment);
+
+            if (scope.res != NO_ERROR)
+            {
+                timer.fail();
+                return std::unexpected(Nic_Error {
+                    .code = Nic_Errc::enter_compartment,
+                    .os_error = scope.res,
+                    .compartment = write.nic->compartment,
+                    .nic = write.nic});
+            }
+
+            auto apply = [&](ADDRESS_FAMILY family, Family_State& current) -> Nic_Result<void>
+            {
+                auto res = update_nic_metric_for_luid(write.nic,
+                                                      family,
+                                                      write.new_metric,
+                                                      current.automatic_metric);
+                if (not res)
+                    return res;
+
+                current = {write.new_metric, false};
+                ++step.writes;
+                return {};
+            };
+
+            if (v4)
+            {
+                if (auto res = apply(AF_INET, families[0]); not res)
+                {
+                    timer.fail();
+                    return std::unexpected(res.error());
+                }
+            }
+
+            if (v6)
+            {
+                if (auto res = apply(AF_INET6, families[1]); not res)
+                {
+                    timer.fail();
+                    return std::unexpected(res.error());
+                }
+            }
+        }
+
+        step.elapsed_ns = static_cast<u64>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - started).count());
+        steps.push_back(std::move(step));
+    }
+
+    return steps;
 }
 
 
-bool is_running_as_administrator()
+Nic_Result<bool> is_running_as_administrator()
 {
     SID_IDENTIFIER_AUTHORITY NtAuthority = SECURITY_NT_AUTHORITY;
     PSID AdministratorsGroup {};
@@ -242,8 +744,7 @@ bool is_running_as_administrator()
     if (not success)
     {
         FreeSid(AdministratorsGroup);
-        throw std::format("[ERROR] Cannot allocate SID: {}",
-                          last_error_as_string(GetLastError()));
+        return std::unexpected(Nic_Error {Nic_Errc::allocate_sid, GetLastError()});
     }
 
     BOOL is_member = FALSE;
@@ -252,9 +753,9 @@ bool is_running_as_administrator()
 
     if (not success)
     {
+        DWORD error = GetLastError();
         FreeSid(AdministratorsGroup);
-        throw std::format("[ERROR] CheckTokenMembership failed: {}",
-                          last_error_as_string(GetLastError()));
+        return std::unexpected(Nic_Error {Nic_Errc::check_token_membership, error});
     }
 
     FreeSid(AdministratorsGroup);
@@ -297,10 +798,317 @@ str_cref get_description(const shared<Interface> &nic)
     return nic->description;
 }
 
+str_cref get_ip(const shared<Interface>& nic)
+{
+    return nic->ip;
+}
+
+u32 get_subnet(const shared<Interface>& nic)
+{
+    return nic->subnet;
+}
+
+str_cref get_gateway(const shared<Interface>& nic)
+{
+    return nic->gateway;
+}
+
+str_cref get_dns(const shared<Interface>& nic)
+{
+    return nic->dns;
+}
+
+str_cref get_dns_suffix(const shared<Interface>& nic)
+{
+    return nic->dns_suff;
+}
+
+std::optional<u32> get_metric(const shared<Interface>& nic)
+{
+    if (not nic->ipv4_enabled)
+        return std::nullopt;
+
+    return nic->metric;
+}
+
+std::optional<u32> get_metric_v6(const shared<Interface>& nic)
+{
+    if (not nic->ipv6_enabled)
+        return std::nullopt;
+
+    return nic->metric_v6;
+}
+
+u32 effective_metric(const shared<Interface>& nic)
+{
+    return get_metric(nic).value_or(get_metric_v6(nic).value_or(UINT32_MAX));
+}
+
+bool is_automatic_metric(const shared<Interface>& nic)
+{
+    return (nic->ipv4_enabled and nic->automatic_metric) or
+           (nic->ipv6_enabled and nic->automatic_metric_v6);
+}
+
+bool is_connected(const shared<Interface>& nic)
+{
+    return nic->connected;
+}
+
+u32 get_compartment(const shared<Interface>& nic)
+{
+    return nic->compartment;
+}
+
+u64 get_luid(const shared<Interface>& nic)
+{
+    return nic->luid.Value;
+}
+
+Nic_Result<shared<Nic_Watch>> watch_nic_changes(Nic_Change_Callback callback)
+{
+    auto watch = std::make_shared<Nic_Watch>();
+    watch->callback = std::move(callback);
+
+    DWORD result = NotifyIpInterfaceChange(
+        AF_UNSPEC,
+        &on_ip_interface_change,
+        watch.get(),
+        FALSE,
+        &watch->handle);
+
+    if (result != NO_ERROR)
+    {
+        watch->handle = NULL;
+        return std::unexpected(Nic_Error {Nic_Errc::notify_change, result});
+    }
+
+    return watch;
+}
+
+shared<Interface> apply_nic_change(const shared<Interface>& nic,
+                                   const Nic_Change& change)
+{
+    auto updated = std::make_shared<Interface>(*nic);
+
+    updated->connected = change.connected;
+
+    if (change.family == AF_INET6)
+    {
+        updated->metric_v6 = change.metric;
+        updated->automatic_metric_v6 = change.automatic_metric;
+    }
+    else
+    {
+        updated->metric = change.metric;
+        updated->automatic_metric = change.automatic_metric;
+    }
+
+    return updated;
+}
+
+str to_string(const Nic_Error& error)
+{
+    // NOTE: rendered only when somebody wants to read it, the error
+    // itself is just a few integers
+    auto os_error = [&error]()
+    {
+        return last_error_as_string(error.os_error);
+    };
+
+    auto family = [&error]()
+    {
+        return error.family == AF_INET6 ? "IPv6" : "IPv4";
+    };
+
+    auto name = [&error]()
+    {
+        return error.nic ? error.nic->name.c_str() : "";
+    };
+
+    switch (error.code)
+    {
+    case Nic_Errc::out_of_memory:
+        return std::format("[ERROR] cannot allocate memory!");
+
+    case Nic_Errc::get_adapters_addresses:
+        return std::format("[ERROR] cannot get adapters addresses: {}",
+                           os_error());
+
+    case Nic_Errc::get_ip_interface_entry:
+        return std::format("[ERROR] cannot get {} interface entry '{}': {}",
+                           family(), name(), os_error());
+
+    case Nic_Errc::set_ip_interface_entry:
+        return std::format("[ERROR] Cannot update {} metric for interface '{}': {}",
+                           family(), name(), os_error());
+
+    case Nic_Errc::enter_compartment:
+        return std::format("[ERROR] cannot enter compartment {}: {}",
+                           error.compartment, os_error());
+
+    case Nic_Errc::allocate_sid:
+        return std::format("[ERROR] Cannot allocate SID: {}",
+                           os_error());
+
+    case Nic_Errc::check_token_membership:
+        return std::format("[ERROR] CheckTokenMembership failed: {}",
+                           os_error());
+
+    case Nic_Errc::notify_change:
+        return std::format("[ERROR] cannot watch interface changes: {}",
+                           os_error());
+
+    case Nic_Errc::socket:
+        return std::format("[ERROR] query socket failed: {}",
+                           os_error());
+
+    case Nic_Errc::get_ip_forward_table:
+        return std::format("[ERROR] cannot read the route table: {}",
+                           os_error());
+
+    case Nic_Errc::get_if_table:
+        return std::format("[ERROR] cannot read interface counters: {}",
+                           os_error());
+
+    case Nic_Errc::icmp:
+        return std::format("[ERROR] cannot send icmp echo: {}",
+                           os_error());
+    }
+
+    return std::format("[ERROR] unknown error {}", u32(error.code));
+}
+
+
 // private stuff
 
+bool glob_match(const wchar_t* pattern, const wchar_t* text)
+{
+    // NOTE: iterative matcher, on mismatch we only ever backtrack to the
+    // last '*' so it stays linear-ish even for nasty patterns
+    const wchar_t* star = nullptr;
+    const wchar_t* star_text = nullptr;
+
+    while (*text != L'\0')
+    {
+        if (*pattern == L'*')
+        {
+            star = pattern++;
+            star_text = text;
+        }
+        else if (*pattern == L'?' or
+                 (*pattern != L'\0' and towlower(*pattern) == towlower(*text)))
+        {
+            ++pattern;
+            ++text;
+        }
+        else if (star != nullptr)
+        {
+            pattern = star + 1;
+            text = ++star_text;
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    while (*pattern == L'*')
+        ++pattern;
+
+    return *pattern == L'\0';
+}
+
+bool adapter_passes_filter(const IP_ADAPTER_ADDRESSES* adapter,
+                           const Nic_Filter& filter,
+                           wstr_cref name_glob)
+{
+    // cheapest checks first, the name is the only one that costs anything
+    if (filter.connected_only and adapter->OperStatus != IfOperStatusUp)
+        return false;
+
+    if (filter.if_type != 0 and adapter->IfType != filter.if_type)
+        return false;
+
+    if (not name_glob.empty() and
+        not glob_match(name_glob.c_str(), adapter->FriendlyName))
+    {
+        return false;
+    }
+
+    return true;
+}
+
+str address_to_string(const SOCKET_ADDRESS& address)
+{
+    wchar_t address_str[INET6_ADDRSTRLEN] {};
+
+    if (address.lpSockaddr->sa_family == AF_INET6)
+    {
+        auto* sockaddr_ipv6 = reinterpret_cast<sockaddr_in6*>(address.lpSockaddr);
+        InetNtopW(AF_INET6, &sockaddr_ipv6->sin6_addr, address_str, INET6_ADDRSTRLEN);
+    }
+    else
+    {
+        auto* sockaddr_ipv4 = reinterpret_cast<sockaddr_in*>(address.lpSockaddr);
+        InetNtopW(AF_INET, &sockaddr_ipv4->sin_addr, address_str, INET6_ADDRSTRLEN);
+    }
+
+    return to_UTF8(address_str);
+}
+
+Interface parse_adapter(const IP_ADAPTER_ADDRESSES* adapter)
+{
+    QTNIC_TRACE_SCOPE("parse_adapter");
+
+    Interface itf {};
+
+    itf.name = to_UTF8(adapter->FriendlyName);
+    itf.match_key = normalize_name(itf.name);
+    itf.description = to_UTF8(adapter->Description);
+    itf.connected = adapter->OperStatus == IfOperStatusUp;
+    itf.dns_suff = to_UTF8(adapter->DnsSuffix);
+    itf.metric = adapter->Ipv4Metric;
+    itf.metric_v6 = adapter->Ipv6Metric;
+    itf.ipv4_enabled = (adapter->Flags & IP_ADAPTER_IPV4_ENABLED) != 0;
+    itf.ipv6_enabled = (adapter->Flags & IP_ADAPTER_IPV6_ENABLED) != 0;
+    itf.index = adapter->IfIndex;
+    itf.luid = adapter->Luid;
+
+    // get all the IPs, both families
+    for (IP_ADAPTER_UNICAST_ADDRESS_LH* unicast_addr = adapter->FirstUnicastAddress;
+         unicast_addr != nullptr;
+         unicast_addr = unicast_addr->Next)
+    {
+        itf.ip.append(address_to_string(unicast_addr->Address)).append(" ");
+
+        if (unicast_addr->Address.lpSockaddr->sa_family == AF_INET)
+            itf.subnet = unicast_addr->OnLinkPrefixLength;
+    }
+
+    // get all the Gateway
+    for (IP_ADAPTER_GATEWAY_ADDRESS_LH* gateway_addr = adapter->FirstGatewayAddress;
+         gateway_addr != nullptr;
+         gateway_addr = gateway_addr->Next)
+    {
+        itf.gateway.append(address_to_string(gateway_addr->Address)).append(" ");
+    }
+
+    // get all the DNS
+    for (IP_ADAPTER_DNS_SERVER_ADDRESS_XP* dns_addr = adapter->FirstDnsServerAddress;
+         dns_addr != nullptr;
+         dns_addr = dns_addr->Next)
+    {
+        itf.dns.append(address_to_string(dns_addr->Address)).append(" ");
+    }
+
+    return itf;
+}
+
 str to_UTF8(wstr_cref wide_str)
 {
+    QTNIC_TRACE_SCOPE("to_UTF8");
+
     int size = WideCharToMultiByte(
         CP_UTF8, 0, wide_str.c_str(), -1,
         nullptr, 0, nullptr, nullptr);
@@ -314,11 +1122,17 @@ str to_UTF8(wstr_cref wide_str)
         CP_UTF8, 0, wide_str.c_str(), -1,
         &utf8_str[0], size, nullptr, nullptr);
 
+    // NOTE: size counts the terminator, keep it out of the string or
+    // it ends up in the middle of everything we append
+    utf8_str.resize(size - 1);
+
     return utf8_str;
 }
 
 wstr to_wide(str_cref utf8_str)
 {
+    QTNIC_TRACE_SCOPE("to_wide");
+
     int size = MultiByteToWideChar(
         CP_UTF8, 0, utf8_str.data(),
         -1, nullptr, 0);
@@ -332,10 +1146,65 @@ wstr to_wide(str_cref utf8_str)
         CP_UTF8, 0, utf8_str.data(),
         -1, &wide_str[0], size);
 
+    wide_str.resize(size - 1);
+
     return wide_str;
 }
 
 str last_error_as_string(DWORD last_error)
+{
+    // NOTE: the same handful of codes keep coming back, so the rendered
+    // messages live in a tiny LRU and FormatMessageW is paid only once
+    struct Cache_Entry
+    {
+        DWORD code {0};
+        u64 last_used {0};
+        str message;
+    };
+
+    static std::mutex cache_mutex;
+    static std::array<Cache_Entry, 16> cache {};
+    static size_t cache_used = 0;
+    static u64 cache_clock = 0;
+
+    {
+        std::lock_guard lock(cache_mutex);
+
+        for (size_t i = 0; i < cache_used; ++i)
+        {
+            if (cache[i].code == last_error)
+            {
+                cache[i].last_used = ++cache_clock;
+                return cache[i].message;
+            }
+        }
+    }
+
+    str message = format_error_message(last_error);
+
+    std::lock_guard lock(cache_mutex);
+
+    size_t slot = 0;
+
+    if (cache_used < cache.size())
+    {
+        slot = cache_used++;
+    }
+    else
+    {
+        for (size_t i = 1; i < cache.size(); ++i)
+        {
+            if (cache[i].last_used < cache[slot].last_used)
+                slot = i;
+        }
+    }
+
+    cache[slot] = {last_error, ++cache_clock, message};
+
+    return message;
+}
+
+str format_error_message(DWORD last_error)
 {
     auto constexpr buffer_count = 1024;
     WCHAR buffer[buffer_count] {};
@@ -354,42 +1223,105 @@ str last_error_as_string(DWORD last_error)
     return to_UTF8(wstr(buffer, size));
 }
 
-void update_nic_metric_for_luid(str_cref interface_name,
-                                IF_LUID luid,
-                                ULONG new_metric,
-                                bool automatic_metric)
+DWORD get_ip_interface_entry(MIB_IPINTERFACE_ROW* row)
+{
+    QTNIC_TRACE_SCOPE("GetIpInterfaceEntry");
+    Op_Timer timer(Nic_Op::get_ip_interface_entry);
+
+    DWORD result = GetIpInterfaceEntry(row);
+
+    // NOTE: not found just means the family is not bound
+    if (result != NO_ERROR and result != ERROR_NOT_FOUND)
+        timer.fail();
+
+    return result;
+}
+
+DWORD set_ip_interface_entry(MIB_IPINTERFACE_ROW* row)
+{
+    QTNIC_TRACE_SCOPE("SetIpInterfaceEntry");
+    Op_Timer timer(Nic_Op::set_ip_interface_entry);
+
+    DWORD result = SetIpInterfaceEntry(row);
+
+    if (result != NO_ERROR)
+        timer.fail();
+
+    return result;
+}
+
+// NOTE: Get, change, Set. With only_if_drifted nothing is written when
+// the metric is already there and automatic metric is off; true when
+// something was written
+static Nic_Result<bool> write_nic_metric(const shared<Interface>& nic,
+                                         ADDRESS_FAMILY family,
+                                         ULONG new_metric,
+                                         bool automatic_metric,
+                                         bool only_if_drifted)
 {
-    // Retrieve the IP interface table
     MIB_IPINTERFACE_ROW row {};
-    row.Family = AF_INET; // IPv4
-    row.InterfaceLuid = luid;
-    row.SitePrefixLength = 32; // For an IPv4 address, any value greater than 32 is an illegal value.
+    row.Family = family;
+    row.InterfaceLuid = nic->luid;
 
-    DWORD result = GetIpInterfaceEntry(&row);
+    DWORD result = get_ip_interface_entry(&row);
 
     if (result != NO_ERROR)
     {
-        throw std::format("[ERROR] cannot get interface entry: {}",
-                          last_error_as_string(result));
+        return std::unexpected(Nic_Error {
+            .code = Nic_Errc::get_ip_interface_entry,
+            .os_error = result,
+            .family = family,
+            .nic = nic});
     }
 
+    if (only_if_drifted and row.Metric == new_metric and not row.UseAutomaticMetric)
+        return false;
+
     if (automatic_metric)
     {
         row.UseAutomaticMetric = 0;
     }
 
-    // Change the metric
-    row.Metric = new_metric; // Set the desired metric
+    row.Metric = new_metric;
 
-    // Set the modified IP interface entry
-    result = SetIpInterfaceEntry(&row);
+    // NOTE: Get hands back a prefix length Set refuses for IPv4
+    if (family == AF_INET)
+    {
+        row.SitePrefixLength = 0;
+    }
+
+    result = set_ip_interface_entry(&row);
 
     if (result != NO_ERROR)
     {
-        throw std::format("[ERROR] Cannot update metric for interface '{}': {}",
-                          interface_name, last_error_as_string(result));
+        return std::unexpected(Nic_Error {
+            .code = Nic_Errc::set_ip_interface_entry,
+            .os_error = result,
+            .family = family,
+            .nic = nic});
     }
 
+    return true;
+}
+
+Nic_Result<void> update_nic_metric_for_luid(const shared<Interface>& nic,
+                                            ADDRESS_FAMILY family,
+                                            ULONG new_metric,
+                                            bool automatic_metric)
+{
+    auto res = write_nic_metric(nic, family, new_metric, automatic_metric, false);
+
+    if (not res)
+        return std::unexpected(res.error());
+
+    return {};
+}
+
+Nic_Result<bool> enforce_nic_metric_for_luid(const shared<Interface>& nic,
+                                             ADDRESS_FAMILY family,
+                                             ULONG metric)
+{
+    return write_nic_metric(nic, family, metric, true, true);
 }
 
 vec<str> split_string_by_newline(str_cref text)
@@ -400,6 +1332,10 @@ vec<str> split_string_by_newline(str_cref text)
 
     while (std::getline(stream, line))
     {
+        // files written on windows come with \r\n
+        if (not line.empty() and line.back() == '\r')
+            line.pop_back();
+
         lines.push_back(line);
     }
 
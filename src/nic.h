@@ -3,6 +3,9 @@
 
 #include <assert.h>
 #include <cstdint>
+#include <expected>
+#include <functional>
+#include <optional>
 #include <print>
 #include <string_view>
 #include <string>
@@ -37,17 +40,201 @@ using shared = shared_ptr<T>;
 
 struct Interface;
 
-vec<shared<Interface>> collect_nic_info();
-u32 update_nic_metric(const vec<shared<Interface>>& interfaces,
-                       str_cref new_metric);
+enum class Nic_Errc : u8
+{
+    out_of_memory,
+    get_adapters_addresses,
+    get_ip_interface_entry,
+    set_ip_interface_entry,
+    enter_compartment,
+    allocate_sid,
+    check_token_membership,
+    notify_change,
+    socket,
+    get_ip_forward_table,
+    get_if_table,
+    icmp,
+};
 
+// NOTE: cheap to create and to copy, the message is only rendered by
+// to_string() when somebody actually wants to show it
+struct Nic_Error
+{
+    Nic_Errc code {};
+    u32 os_error {0}; // win32 error code, 0 if none
+    u16 family {0}; // AF_INET / AF_INET6, 0 if not relevant
+    u32 compartment {0};
+    shared<Interface> nic; // the interface we were working on, if any
+};
+
+template<typename T>
+using Nic_Result = std::expected<T, Nic_Error>;
+
+enum class Nic_Change_Kind : u8
+{
+    added,
+    removed,
+    changed,
+};
+
+// NOTE: one kernel delta for one address family of one interface
+struct Nic_Change
+{
+    u64 luid {0};
+    u16 family {0};
+    Nic_Change_Kind kind {Nic_Change_Kind::changed};
+    u32 metric {0};
+    bool automatic_metric {false};
+    bool connected {false};
+};
+
+// NOTE: gets every interface as soon as it is converted, return false
+// to stop the enumeration early
+using Nic_Sink = std::function<bool(shared<Interface>)>;
+
+struct Nic_Watch;
+using Nic_Change_Callback = std::function<void(const Nic_Change&)>;
+
+// NOTE: checked against the raw adapter before anything gets converted,
+// rejected adapters cost a couple of compares
+struct Nic_Filter
+{
+    bool connected_only {false};
+    str name_glob; // '*' and '?' wildcards, case insensitive, empty matches all
+    u32 if_type {0}; // IFTYPE, e.g. 6 ethernet, 71 wifi, 0 matches all
+};
+
+// NOTE: how the lines of a nic list are compared with interface names.
+// loose ignores case and extra whitespace, so "ethernet  2" finds
+// "Ethernet 2"; glob: and re: rules always see the real name
+enum class Name_Match : u8
+{
+    exact,
+    loose,
+};
+
+struct Metric_Write
+{
+    shared<Interface> nic;
+    u32 new_metric {0};
+
+    // NOTE: what the interface had when it was enumerated, only there so
+    // a dry run can show it; nullopt when the family is off
+    std::optional<u32> old_metric;
+    std::optional<u32> old_metric_v6;
+    bool disable_automatic {false}; // automatic metric on in either family
+};
+
+struct Metric_Plan
+{
+    vec<Metric_Write> writes;
+    u32 skipped {0};
+    vec<str> errors; // rules that did not compile, also counted as skipped
+    vec<str> unmatched; // the name lines behind skipped, see name_suggester.h
+};
+
+// NOTE: kernel writes a plan entry really needs, one per family whose
+// metric differs or still is automatic. 0 means it is already in place
+u32 changed_families(const Metric_Write& write);
+
+struct Plan_Cost
+{
+    u32 writes {0};          // family writes that change something
+    u64 per_write_ns {0};
+    u64 estimated_ns {0};
+    bool measured {false};   // false: no write measured yet, a ballpark
+};
+
+// NOTE: priced with the median SetIpInterfaceEntry latency this process
+// has measured so far (see metrics.h)
+Plan_Cost estimate_plan_cost(const Metric_Plan& plan);
+
+Nic_Result<vec<shared<Interface>>> collect_nic_info(const Nic_Filter& filter = {});
+Nic_Result<void> collect_nic_info(const Nic_Filter& filter, const Nic_Sink& sink);
+Nic_Result<u32> update_nic_metric(const vec<shared<Interface>>& interfaces,
+                                  str_cref new_metric,
+                                  Name_Match match = Name_Match::exact);
+
+// NOTE: network compartments are the windows flavour of linux network
+// namespaces, every compartment gets its own worker and the results are
+// merged in the order the compartments were given
+Nic_Result<vec<shared<Interface>>> collect_nic_info(const vec<u32>& compartments,
+                                                    const Nic_Filter& filter = {});
+
+// NOTE: the streaming flavour walks the compartments one after the other
+// on the calling thread, the sink sees them in the order given
+Nic_Result<void> collect_nic_info(const vec<u32>& compartments,
+                                  const Nic_Filter& filter,
+                                  const Nic_Sink& sink);
+vec<u32> list_network_compartments(u32 max_id = 64);
+
+// NOTE: update_nic_metric() is just these two glued together.
+// Lines starting with glob: or re: are rules, see name_matcher.h
+Metric_Plan plan_nic_metric(const vec<shared<Interface>>& interfaces,
+                            str_cref nic_list,
+                            Name_Match match = Name_Match::exact);
+Nic_Result<void> apply_nic_metric_plan(const Metric_Plan& plan);
+
+// NOTE: the order is already resolved, e.g. rows of the gui model, so
+// there are no names to match and nothing is ever skipped
+Metric_Plan plan_nic_metric(const vec<shared<Interface>>& ordered_interfaces);
+
+// NOTE: same, refilling a plan the caller keeps around, so re-planning on
+// every drag allocates nothing once the plan has grown to size
+void plan_nic_metric(const vec<shared<Interface>>& ordered_interfaces, Metric_Plan& plan);
+
+struct Nic_Profile
+{
+    str name; // only used to label the step
+    str nic_list;
+};
+
+struct Profile_Step
+{
+    str name;
+    u32 writes {0}; // one per interface and family actually written
+    u32 skipped {0};
+    vec<str> unmatched;
+    u64 elapsed_ns {0};
+};
+
+// NOTE: one enumeration for the whole batch. Each profile only writes
+// what differs from where the previous one left the interfaces, the
+// first one from what was enumerated
+Nic_Result<vec<Profile_Step>> apply_nic_profiles(const vec<shared<Interface>>& interfaces,
+                                                 const vec<Nic_Profile>& profiles,
+                                                 Name_Match match = Name_Match::exact);
+
+// NOTE: the callback runs on a system thread, keep it short. Dropping
+// the returned handle stops the notifications
+Nic_Result<shared<Nic_Watch>> watch_nic_changes(Nic_Change_Callback callback);
+
+// NOTE: interfaces are shared, so this hands back an updated copy
+shared<Interface> apply_nic_change(const shared<Interface>& nic,
+                                   const Nic_Change& change);
+
+str to_string(const Nic_Error& error);
 str last_error_as_string(unsigned long last_error);
-bool is_running_as_administrator();
+Nic_Result<bool> is_running_as_administrator();
 unsigned long restart_as_admin();
 
 // NOTE: all this mumbo jumbo to hide windows.h from qt....
 str_cref get_name(const shared<Interface>& nic);
 str_cref get_description(const shared<Interface>& nic);
+str_cref get_ip(const shared<Interface>& nic);
+u32 get_subnet(const shared<Interface>& nic);
+str_cref get_gateway(const shared<Interface>& nic);
+str_cref get_dns(const shared<Interface>& nic);
+str_cref get_dns_suffix(const shared<Interface>& nic);
+std::optional<u32> get_metric(const shared<Interface>& nic); // nullopt if the family is off
+std::optional<u32> get_metric_v6(const shared<Interface>& nic);
+// NOTE: IPv4 metric, else IPv6, else UINT32_MAX; lowest first is the
+// order windows prefers them in
+u32 effective_metric(const shared<Interface>& nic);
+bool is_automatic_metric(const shared<Interface>& nic); // either family
+bool is_connected(const shared<Interface>& nic);
+u32 get_compartment(const shared<Interface>& nic);
+u64 get_luid(const shared<Interface>& nic);
 
 
 #endif // NIC_H
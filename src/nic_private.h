@@ -0,0 +1,128 @@
+#ifndef NIC_PRIVATE_H
+#define NIC_PRIVATE_H
+
+// NOTE: this header drags in windows.h, never include it from qt code!
+
+#include "nic.h"
+
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <winsock2.h>
+#include <ws2ipdef.h>
+#include <ws2tcpip.h> // for inet_ntop function
+#include <iphlpapi.h>
+#include <shellapi.h>
+
+
+struct Interface
+{
+    // NOTE: all std::string are utf-8 encoded
+    str name;
+    str match_key; // normalize_name(name), made once at enumeration
+    str description;
+    str ip;
+    u32 subnet {0};
+    str gateway;
+    str dns;
+    str dns_suff;
+    u32 metric {0}; // IPv4
+    u32 metric_v6 {0};
+    bool automatic_metric {false}; // IPv4
+    bool automatic_metric_v6 {false};
+    bool ipv4_enabled {false};
+    bool ipv6_enabled {false};
+    bool connected {false};
+    IF_LUID luid {};
+    IF_INDEX index {};
+    NET_IF_COMPARTMENT_ID compartment {NET_IF_COMPARTMENT_ID_UNSPECIFIED};
+};
+
+struct WSA_Startup
+{
+    WSA_Startup(WORD version);
+    ~WSA_Startup();
+
+    WSADATA wsa_data {};
+    int res {};
+};
+
+// NOTE: switches the calling thread into another network compartment
+// and back again when it goes out of scope
+struct Compartment_Scope
+{
+    Compartment_Scope(NET_IF_COMPARTMENT_ID compartment);
+    ~Compartment_Scope();
+
+    NET_IF_COMPARTMENT_ID previous {NET_IF_COMPARTMENT_ID_UNSPECIFIED};
+    bool switched {false};
+    DWORD res {NO_ERROR};
+};
+
+struct Nic_Watch
+{
+    ~Nic_Watch();
+
+    HANDLE handle {NULL};
+    Nic_Change_Callback callback;
+};
+
+str to_UTF8(wstr_cref wide_str);
+wstr to_wide(str_cref utf8_str);
+str last_error_as_string(DWORD last_error);
+str format_error_message(DWORD last_error);
+
+// NOTE: '*' and '?' wildcards, case insensitive
+bool glob_match(const wchar_t* pattern, const wchar_t* text);
+bool adapter_passes_filter(const IP_ADAPTER_ADDRESSES* adapter,
+                           const Nic_Filter& filter,
+                           wstr_cref name_glob);
+
+str address_to_string(const SOCKET_ADDRESS& address);
+
+// NOTE: converts one adapter without touching the kernel,
+// automatic_metric is left to the caller
+Interface parse_adapter(const IP_ADAPTER_ADDRESSES* adapter);
+
+// NOTE: the kernel calls, wrapped so every one of them is traced and
+// counted in the always-on stats
+DWORD get_ip_interface_entry(MIB_IPINTERFACE_ROW* row);
+DWORD set_ip_interface_entry(MIB_IPINTERFACE_ROW* row);
+
+Nic_Result<void> update_nic_metric_for_luid(const shared<Interface>& nic,
+                                            ADDRESS_FAMILY family,
+                                            ULONG new_metric,
+                                            bool automatic_metric);
+
+// NOTE: same, but only writes when the metric drifted or automatic metric
+// came back on; true when something was written
+Nic_Result<bool> enforce_nic_metric_for_luid(const shared<Interface>& nic,
+                                             ADDRESS_FAMILY family,
+                                             ULONG metric);
+vec<str> split_string_by_newline(str_cref text);
+
+// NOTE: split_string_by_newline() without building anything, the views
+// point into text
+template<typename Fn>
+void for_each_line(string_view text, Fn&& fn)
+{
+    while (not text.empty())
+    {
+        size_t end = text.find('\n');
+        string_view line = text.substr(0, end);
+
+        // files written on windows come with \r\n
+        if (line.ends_with('\r'))
+            line.remove_suffix(1);
+
+        fn(line);
+
+        if (end == string_view::npos)
+            break;
+
+        text.remove_prefix(end + 1);
+    }
+}
+
+
+#endif // NIC_PRIVATE_H
@@ -0,0 +1,291 @@
+#include "order_enforcer.h"
+
+#include "name_index.h"
+#include "nic_private.h"
+
+#include <algorithm>
+#include <chrono>
+
+using Clock = std::chrono::steady_clock;
+
+static u64 nanoseconds_since(Clock::time_point start)
+{
+    return static_cast<u64>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start).count());
+}
+
+Order_Enforcer::Order_Enforcer(str_cref nic_list, Name_Match match)
+    : nic_list(nic_list)
+    , match(match)
+{
+}
+
+Order_Enforcer::~Order_Enforcer()
+{
+    stop();
+}
+
+Nic_Result<void> Order_Enforcer::start()
+{
+    auto new_watch = watch_nic_changes([this](const Nic_Change& change)
+    {
+        on_change(change);
+    });
+
+    if (not new_watch)
+        return std::unexpected(new_watch.error());
+
+    watch = std::move(*new_watch);
+
+    auto interfaces = collect_nic_info();
+
+    if (not interfaces)
+    {
+        stop();
+        return std::unexpected(interfaces.error());
+    }
+
+    std::scoped_lock lock(mutex);
+
+    // NOTE: the interfaces that came up between the watch and the
+    // enumeration are already known by their alias, they keep their
+    // place but get the full details
+    for (const auto& nic : *interfaces)
+    {
+        auto [it, added] = known.try_emplace(nic->luid.Value, nic);
+
+        if (added)
+        {
+            this->interfaces.push_back(nic);
+            continue;
+        }
+
+        std::ranges::replace(this->interfaces, it->second, nic);
+        it->second = nic;
+    }
+
+    replan();
+
+    for (const auto& nic : this->interfaces)
+    {
+        auto it = desired.find(nic->luid.Value);
+
+        if (it == desired.end())
+            continue;
+
+        u32 metric = it->second;
+
+        auto fix = [&](ADDRESS_FAMILY family, u32 old_metric, bool automatic_metric)
+        {
+            if (old_metric == metric and not automatic_metric)
+                return;
+
+            auto res = update_nic_metric_for_luid(nic, family, metric, true);
+
+            if (not res)
+            {
+                ++failure_count;
+                error = res.error();
+                return;
+            }
+
+            ++correction_count;
+        };
+
+        if (nic->ipv4_enabled)
+            fix(AF_INET, nic->metric, nic->automatic_metric);
+
+        if (nic->ipv6_enabled)
+            fix(AF_INET6, nic->metric_v6, nic->automatic_metric_v6);
+    }
+
+    return {};
+}
+
+void Order_Enforcer::stop()
+{
+    // NOTE: waits for a callback that is already running
+    watch.reset();
+}
+
+u64 Order_Enforcer::events() const
+{
+    return event_count.load();
+}
+
+u64 Order_Enforcer::corrections() const
+{
+    return correction_count.load();
+}
+
+u64 Order_Enforcer::failures() const
+{
+    return failure_count.load();
+}
+
+std::optional<Nic_Error> Order_Enforcer::last_error() const
+{
+    std::scoped_lock lock(mutex);
+    return error;
+}
+
+const Latency_Histogram& Order_Enforcer::reaction_latency() const
+{
+    return reaction;
+}
+
+const Latency_Histogram& Order_Enforcer::check_latency() const
+{
+    return check;
+}
+
+void Order_Enforcer::on_change(const Nic_Change& change)
+{
+    auto received = Clock::now();
+    ++event_count;
+
+    std::scoped_lock lock(mutex);
+
+    // NOTE: removals come per family, unbinding IPv6 alone must not take
+    // the interface out of the order
+    if (change.kind == Nic_Change_Kind::removed)
+    {
+        u16 other = change.family == AF_INET ? AF_INET6 : AF_INET;
+
+        if (not family_bound(change.luid, other))
+            forget_interface(change.luid, received);
+
+        return;
+    }
+
+    if (auto nic = known_interface(change.luid, received))
+        correct(nic, change.family, received);
+}
+
+shared<Interface> Order_Enforcer::known_interface(u64 luid, Time_Point received)
+{
+    if (auto it = known.find(luid); it != known.end())
+        return it->second;
+
+    // NOTE: first time we hear of it, the alias is the same friendly
+    // name GetAdaptersAddresses reports and costs no enumeration
+    NET_LUID net_luid {};
+    net_luid.Value = luid;
+
+    wchar_t alias[NDIS_IF_MAX_STRING_SIZE + 1] {};
+
+    if (ConvertInterfaceLuidToAlias(&net_luid, alias, std::size(alias)) != NO_ERROR)
+        return nullptr;
+
+    auto nic = std::make_shared<Interface>();
+    nic->name = to_UTF8(alias);
+    nic->match_key = normalize_name(nic->name);
+    nic->luid = net_luid;
+
+    known.emplace(luid, nic);
+    interfaces.push_back(nic);
+
+    // the new one itself is corrected by the notification that brought it
+    auto moved = replan();
+    std::erase(moved, nic);
+    move_along(moved, received);
+
+    return nic;
+}
+
+bool Order_Enforcer::family_bound(u64 luid, u16 family)
+{
+    MIB_IPINTERFACE_ROW row {};
+    row.Family = family;
+    row.InterfaceLuid.Value = luid;
+
+    return get_ip_interface_entry(&row) == NO_ERROR;
+}
+
+void Order_Enforcer::forget_interface(u64 luid, Time_Point received)
+{
+    auto it = known.find(luid);
+
+    if (it == known.end())
+        return;
+
+    std::erase(interfaces, it->second);
+    known.erase(it);
+
+    move_along(replan(), received);
+}
+
+vec<shared<Interface>> Order_Enforcer::replan()
+{
+    auto plan = plan_nic_metric(interfaces, nic_list, match);
+
+    // NOTE: a name listed twice is written twice, the last write stays
+    std::unordered_map<u64, u32> next;
+    next.reserve(plan.writes.size());
+
+    for (const auto& write : plan.writes)
+        next.insert_or_assign(write.nic->luid.Value, write.new_metric);
+
+    vec<shared<Interface>> moved;
+
+    for (const auto& nic : interfaces)
+    {
+        auto it = next.find(nic->luid.Value);
+
+        if (it == next.end())
+            continue;
+
+        auto old = desired.find(nic->luid.Value);
+
+        if (old == desired.end() or old->second != it->second)
+            moved.push_back(nic);
+    }
+
+    desired = std::move(next);
+    return moved;
+}
+
+void Order_Enforcer::move_along(const vec<shared<Interface>>& moved, Time_Point received)
+{
+    for (const auto& nic : moved)
+    {
+        correct(nic, AF_INET, received);
+        correct(nic, AF_INET6, received);
+    }
+}
+
+void Order_Enforcer::correct(const shared<Interface>& nic, u16 family, Time_Point received)
+{
+    auto it = desired.find(nic->luid.Value);
+
+    // not in the list
+    if (it == desired.end())
+        return;
+
+    // NOTE: the notification row is not guaranteed to carry more than
+    // luid and family, so the decision is made on a fresh read
+    auto written = enforce_nic_metric_for_luid(nic, family, it->second);
+
+    if (not written)
+    {
+        // gone again before we got to it, or the family is off
+        bool gone = written.error().code == Nic_Errc::get_ip_interface_entry and
+                    written.error().os_error == ERROR_NOT_FOUND;
+
+        if (not gone)
+        {
+            ++failure_count;
+            error = written.error();
+        }
+        return;
+    }
+
+    if (not *written)
+    {
+        check.record(nanoseconds_since(received));
+        return;
+    }
+
+    ++correction_count;
+    reaction.record(nanoseconds_since(received));
+}
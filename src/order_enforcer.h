@@ -0,0 +1,76 @@
+#ifndef ORDER_ENFORCER_H
+#define ORDER_ENFORCER_H
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+
+#include "metrics.h"
+#include "nic.h"
+
+// NOTE: keeps the interfaces in the order of a nic list for as long as
+// it lives. The metrics are the ones plan_nic_metric() gives for the
+// interfaces there are right now, so apply followed by daemon writes
+// nothing. When an interface comes or goes the plan is redone and the
+// ones it shifted are moved along, like a fresh apply would.
+// Corrections are made straight from the kernel notification, for the
+// one interface and family that drifted, and our own writes come back
+// as notifications that are already in order
+class Order_Enforcer
+{
+public:
+    explicit Order_Enforcer(str_cref nic_list, Name_Match match = Name_Match::exact);
+    ~Order_Enforcer();
+
+    Order_Enforcer(const Order_Enforcer&) = delete;
+    Order_Enforcer& operator=(const Order_Enforcer&) = delete;
+
+    // starts watching, then enumerates once and fixes what already drifted
+    Nic_Result<void> start();
+    void stop();
+
+    u64 events() const;
+    u64 corrections() const;
+    u64 failures() const;
+    std::optional<Nic_Error> last_error() const;
+
+    // NOTE: both measured from the moment the notification reaches us,
+    // the kernel does not tell when the link actually came up
+    const Latency_Histogram& reaction_latency() const; // drift corrected
+    const Latency_Histogram& check_latency() const;    // nothing to do
+
+private:
+    using Time_Point = std::chrono::steady_clock::time_point;
+
+    void on_change(const Nic_Change& change);
+    shared<Interface> known_interface(u64 luid, Time_Point received);
+    void forget_interface(u64 luid, Time_Point received);
+    bool family_bound(u64 luid, u16 family);
+
+    // the listed interfaces whose metric changed
+    vec<shared<Interface>> replan();
+    void move_along(const vec<shared<Interface>>& moved, Time_Point received);
+    void correct(const shared<Interface>& nic, u16 family, Time_Point received);
+
+    str nic_list;
+    Name_Match match;
+
+    // NOTE: every interface seen so far, listed or not, in the order we
+    // learned about it, which is the order rules hand out metrics in
+    vec<shared<Interface>> interfaces;
+    std::unordered_map<u64, shared<Interface>> known;
+    std::unordered_map<u64, u32> desired; // luid, metric
+    std::optional<Nic_Error> error;
+    mutable std::mutex mutex;
+
+    shared<Nic_Watch> watch;
+
+    std::atomic<u64> event_count {0};
+    std::atomic<u64> correction_count {0};
+    std::atomic<u64> failure_count {0};
+    Latency_Histogram reaction;
+    Latency_Histogram check;
+};
+
+#endif // ORDER_ENFORCER_H
@@ -0,0 +1,1109 @@
+// qtnic-cli: the same ordering engine as the gui, without the gui.
+// Meant for scripts, so it never asks for elevation and answers with
+// exit codes: 0 ok, 1 error, 2 bad usage, 3 some lines were skipped.
+
+#include "apply_executor.h"
+#include "gateway_prober.h"
+#include "metrics.h"
+#include "name_suggester.h"
+#include "nic.h"
+#include "order_enforcer.h"
+#include "query_server.h"
+#include "route_table.h"
+#include "trace.h"
+#include "traffic_sampler.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cctype>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <print>
+#include <sstream>
+#include <thread>
+#include <unordered_map>
+
+#include "rapidjson/prettywriter.h"
+#include "rapidjson/stringbuffer.h"
+
+using Json_Writer = rapidjson::PrettyWriter<rapidjson::StringBuffer>;
+
+enum Exit_Code : int
+{
+    exit_ok = 0,
+    exit_error = 1,
+    exit_usage = 2,
+    exit_skipped = 3,
+};
+
+struct Cli_Options
+{
+    str command;
+    vec<str> args;
+    Nic_Filter filter;
+    u32 report_seconds {60};
+    bool serve {false};
+    str socket_path;
+    str trace_path;
+    bool stats {false};
+    bool apply {false};
+    u32 jobs {1};
+    Name_Match match {Name_Match::exact};
+    bool all_compartments {false};
+};
+
+static std::atomic<bool> stop_requested {false};
+
+
+static void print_usage()
+{
+    std::println(stderr,
+        "usage: qtnic-cli <command> [options]\n"
+        "\n"
+        "commands:\n"
+        "  list              current order, one interface per line\n"
+        "  apply <file|->... apply the order listed in file (or stdin), several\n"
+        "                    files are applied back to back with timings\n"
+        "  diff <file|->     show the metric changes apply would make\n"
+        "  export [file]     every interface with all its details as json\n"
+        "  daemon <file|->   keep the order listed in file until ctrl+c,\n"
+        "                    putting back whatever drifts, same metrics as\n"
+        "                    apply for the interfaces that are there\n"
+        "  serve             answer list/order/filter queries on a local socket\n"
+        "  route <file|->    egress interface of every IPv4 address in file\n"
+        "  traffic [seconds] rx/tx rate of every interface, once a second\n"
+        "  probe             ping every gateway, print the order by latency\n"
+        "  whatif <order> <destinations>\n"
+        "                    how many destinations would leave through another\n"
+        "                    interface once order is applied, nothing is written\n"
+        "\n"
+        "options:\n"
+        "  --connected       only interfaces that are up\n"
+        "  --name <glob>     only interfaces whose name matches the glob\n"
+        "                    (daemon: only what --serve answers)\n"
+        "  --all-compartments\n"
+        "                    every network compartment, not just ours\n"
+        "  --report <secs>   daemon: print latency stats this often (0 = never)\n"
+        "  --serve           daemon: also answer queries, like serve\n"
+        "  --socket <path>   socket for serve, default qtnic.sock in the temp dir\n"
+        "  --trace <file>    write a chrome trace on exit (QTNIC_TRACE builds)\n"
+        "  --stats           print call counts and latencies on exit\n"
+        "  --apply           probe: also apply the order by latency\n"
+        "  --jobs <n>        apply: write up to n interfaces at once and print\n"
+        "                    how long each one took, a single file only\n"
+        "  --loose           apply, diff, whatif, daemon: names match ignoring\n"
+        "                    case and extra whitespace");
+}
+
+static bool parse_options(int argc, char* argv[], Cli_Options& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        string_view arg = argv[i];
+
+        if (arg == "--connected")
+        {
+            options.filter.connected_only = true;
+        }
+        else if (arg == "--all-compartments")
+        {
+            options.all_compartments = true;
+        }
+        else if (arg == "--name" and i + 1 < argc)
+        {
+            options.filter.name_glob = argv[++i];
+        }
+        else if (arg == "--report" and i + 1 < argc)
+        {
+            options.report_seconds = static_cast<u32>(std::strtoul(argv[++i], nullptr, 10));
+        }
+        else if (arg == "--serve")
+        {
+            options.serve = true;
+        }
+        else if (arg == "--socket" and i + 1 < argc)
+        {
+            options.socket_path = argv[++i];
+        }
+        else if (arg == "--trace" and i + 1 < argc)
+        {
+            options.trace_path = argv[++i];
+        }
+        else if (arg == "--stats")
+        {
+            options.stats = true;
+        }
+        else if (arg == "--apply")
+        {
+            options.apply = true;
+        }
+        else if (arg == "--loose")
+        {
+            options.match = Name_Match::loose;
+        }
+        else if (arg == "--jobs" and i + 1 < argc)
+        {
+            options.jobs = std::max(1u, static_cast<u32>(std::strtoul(argv[++i], nullptr, 10)));
+        }
+        else if (arg.starts_with("--"))
+        {
+            return false;
+        }
+        else if (options.command.empty())
+        {
+            options.command = arg;
+        }
+        else
+        {
+            options.args.emplace_back(arg);
+        }
+    }
+
+    return not options.command.empty();
+}
+
+static std::optional<str> read_text(str_cref path)
+{
+    if (path == "-")
+    {
+        return str(std::istreambuf_iterator<char>(std::cin),
+                   std::istreambuf_iterator<char>());
+    }
+
+    std::ifstream file(path, std::ios::binary);
+
+    if (not file)
+        return std::nullopt;
+
+    std::ostringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+static int list_command(const vec<shared<Interface>>& interfaces)
+{
+    auto ordered = interfaces;
+
+    std::stable_sort(ordered.begin(), ordered.end(),
+                     [](const auto& a, const auto& b)
+                     {
+                         return effective_metric(a) < effective_metric(b);
+                     });
+
+    for (const auto& nic : ordered)
+        std::println("{}", get_name(nic));
+
+    return exit_ok;
+}
+
+static void print_rule_errors(const Metric_Plan& plan)
+{
+    for (const auto& error : plan.errors)
+        std::println(stderr, "[ERROR] bad rule {}", error);
+}
+
+// NOTE: the closest interface names for every line that found nothing,
+// the index is only built the first time there is something to look up
+// and callers printing more than once keep it around
+static void print_suggestions(const vec<shared<Interface>>& interfaces,
+                              const vec<str>& unmatched,
+                              std::optional<Name_Suggester>& suggester)
+{
+    if (unmatched.empty())
+        return;
+
+    if (not suggester)
+        suggester.emplace().build(interfaces);
+
+    for (const auto& line : unmatched)
+    {
+        auto suggestions = suggester->suggest(line);
+
+        if (suggestions.empty())
+        {
+            std::println(stderr, "  '{}': no similar interface", line);
+            continue;
+        }
+
+        str names;
+
+        for (const auto& suggestion : suggestions)
+        {
+            if (not names.empty())
+                names.append(", ");
+
+            names.append("'").append(suggestion.name).append("'");
+        }
+
+        std::println(stderr, "  '{}': did you mean {}?", line, names);
+    }
+}
+
+static void print_suggestions(const vec<shared<Interface>>& interfaces,
+                              const vec<str>& unmatched)
+{
+    std::optional<Name_Suggester> suggester;
+    print_suggestions(interfaces, unmatched, suggester);
+}
+
+static int apply_command(const vec<shared<Interface>>& interfaces,
+                         str_cref path,
+                         Name_Match match)
+{
+    auto nic_list = read_text(path);
+
+    if (not nic_list)
+    {
+        std::println(stderr, "[ERROR] cannot read '{}'", path);
+        return exit_error;
+    }
+
+    // NOTE: update_nic_metric() in two steps, to get the skipped lines
+    auto plan = plan_nic_metric(interfaces, *nic_list, match);
+
+    if (auto res = apply_nic_metric_plan(plan); not res)
+    {
+        std::println(stderr, "{}", to_string(res.error()));
+        return exit_error;
+    }
+
+    print_rule_errors(plan);
+
+    if (plan.skipped != 0)
+    {
+        std::println(stderr, "Warning! {} interface/s skipped", plan.skipped);
+        print_suggestions(interfaces, plan.unmatched);
+        return exit_skipped;
+    }
+
+    return exit_ok;
+}
+
+static int apply_parallel_command(const vec<shared<Interface>>& interfaces,
+                                  str_cref path,
+                                  u32 jobs,
+                                  Name_Match match)
+{
+    auto nic_list = read_text(path);
+
+    if (not nic_list)
+    {
+        std::println(stderr, "[ERROR] cannot read '{}'", path);
+        return exit_error;
+    }
+
+    auto plan = plan_nic_metric(interfaces, *nic_list, match);
+
+    Kernel_Backend backend;
+    auto report = apply_nic_metric_plan(plan, backend, jobs);
+
+    for (const auto& write : report.writes)
+    {
+        std::println("{}: {:.3f} ms{}",
+                     get_name(write.nic),
+                     double(write.latency_ns) / 1e6,
+                     write.error ? " (failed)" : "");
+    }
+
+    std::println("{} interface/s in {:.3f} ms with {} job/s",
+                 report.writes.size(),
+                 double(report.elapsed_ns) / 1e6,
+                 jobs);
+
+    if (auto error = report.first_error())
+    {
+        std::println(stderr, "{}", to_string(*error));
+        return exit_error;
+    }
+
+    print_rule_errors(plan);
+
+    if (plan.skipped != 0)
+    {
+        std::println(stderr, "Warning! {} interface/s skipped", plan.skipped);
+        print_suggestions(interfaces, plan.unmatched);
+        return exit_skipped;
+    }
+
+    return exit_ok;
+}
+
+static int apply_profiles_command(const vec<shared<Interface>>& interfaces,
+                                  const vec<str>& paths,
+                                  Name_Match match)
+{
+    vec<Nic_Profile> profiles;
+    profiles.reserve(paths.size());
+
+    // NOTE: everything is read up front, a missing file should not leave
+    // the interfaces half way through the batch
+    for (const auto& path : paths)
+    {
+        auto nic_list = read_text(path);
+
+        if (not nic_list)
+        {
+            std::println(stderr, "[ERROR] cannot read '{}'", path);
+            return exit_error;
+        }
+
+        profiles.push_back({path, std::move(*nic_list)});
+    }
+
+    auto steps = apply_nic_profiles(interfaces, profiles, match);
+
+    if (not steps)
+    {
+        std::println(stderr, "{}", to_string(steps.error()));
+        return exit_error;
+    }
+
+    u32 skipped = 0;
+    std::optional<Name_Suggester> suggester;
+
+    for (const auto& step : *steps)
+    {
+        std::println("{}: {} write/s, {} skipped, {:.3f} ms",
+                     step.name,
+                     step.writes,
+                     step.skipped,
+                     double(step.elapsed_ns) / 1e6);
+
+        print_suggestions(interfaces, step.unmatched, suggester);
+        skipped += step.skipped;
+    }
+
+    return skipped == 0 ? exit_ok : exit_skipped;
+}
+
+static int diff_command(const vec<shared<Interface>>& interfaces,
+                        str_cref path,
+                        Name_Match match)
+{
+    auto nic_list = read_text(path);
+
+    if (not nic_list)
+    {
+        std::println(stderr, "[ERROR] cannot read '{}'", path);
+        return exit_error;
+    }
+
+    auto plan = plan_nic_metric(interfaces, *nic_list, match);
+
+    for (const auto& write : plan.writes)
+    {
+        if (changed_families(write) == 0)
+            continue;
+
+        auto old_metric = write.old_metric ? write.old_metric : write.old_metric_v6;
+
+        std::println("{}: {} -> {}{}",
+                     get_name(write.nic),
+                     old_metric ? std::to_string(*old_metric) : str("-"),
+                     write.new_metric,
+                     write.disable_automatic ? " (automatic metric off)" : "");
+    }
+
+    auto cost = estimate_plan_cost(plan);
+
+    std::println("{} write/s, ~{:.1f} ms ({})",
+                 cost.writes,
+                 double(cost.estimated_ns) / 1e6,
+                 cost.measured ? "measured" : "estimated");
+
+    print_rule_errors(plan);
+
+    if (plan.skipped != 0)
+    {
+        std::println(stderr, "Warning! {} interface/s skipped", plan.skipped);
+        print_suggestions(interfaces, plan.unmatched);
+        return exit_skipped;
+    }
+
+    return exit_ok;
+}
+
+// NOTE: one address or prefix per line, '#' starts a comment and
+// whitespace around it does not count. A prefix counts as its network
+// address, a line that is neither keeps its text and no address
+struct Destination
+{
+    str text;
+    std::optional<u32> address;
+};
+
+static vec<Destination> parse_destinations(str_cref text)
+{
+    vec<Destination> destinations;
+    std::istringstream lines(text);
+    str line;
+
+    auto space = [](char c) { return std::isspace(static_cast<unsigned char>(c)) != 0; };
+
+    while (std::getline(lines, line))
+    {
+        string_view view = line;
+        view = view.substr(0, view.find('#'));
+
+        while (not view.empty() and space(view.back()))
+            view.remove_suffix(1);
+
+        while (not view.empty() and space(view.front()))
+            view.remove_prefix(1);
+
+        if (view.empty())
+            continue;
+
+        auto prefix = parse_ipv4_prefix(view);
+        destinations.push_back({str(view), prefix ? std::optional(prefix->address) : std::nullopt});
+    }
+
+    return destinations;
+}
+
+static int route_command(const vec<shared<Interface>>& interfaces, str_cref path)
+{
+    auto destinations = read_text(path);
+
+    if (not destinations)
+    {
+        std::println(stderr, "[ERROR] cannot read '{}'", path);
+        return exit_error;
+    }
+
+    auto routes = collect_ipv4_routes();
+
+    if (not routes)
+    {
+        std::println(stderr, "{}", to_string(routes.error()));
+        return exit_error;
+    }
+
+    Route_Table table;
+
+    if (not table.build(*routes, current_interface_metrics(interfaces)))
+    {
+        std::println(stderr, "[ERROR] route table too large");
+        return exit_error;
+    }
+
+    std::unordered_map<u64, str> name_of;
+
+    for (const auto& nic : interfaces)
+        name_of.emplace(get_luid(nic), get_name(nic));
+
+    u32 skipped = 0;
+
+    for (const auto& destination : parse_destinations(*destinations))
+    {
+        if (not destination.address)
+        {
+            std::println(stderr, "Warning! '{}' is not an IPv4 address", destination.text);
+            ++skipped;
+            continue;
+        }
+
+        u64 luid = table.lookup(*destination.address);
+        auto it = name_of.find(luid);
+
+        std::println("{} -> {}", destination.text,
+                     luid == 0 ? "no route" :
+                     it == name_of.end() ? std::format("luid {}", luid) : it->second);
+    }
+
+    return skipped == 0 ? exit_ok : exit_skipped;
+}
+
+static int whatif_command(const vec<shared<Interface>>& interfaces,
+                          const vec<str>& args,
+                          Name_Match match)
+{
+    auto nic_list = read_text(args[0]);
+    auto text = read_text(args[1]);
+
+    if (not nic_list or not text)
+    {
+        std::println(stderr, "[ERROR] cannot read '{}'", nic_list ? args[1] : args[0]);
+        return exit_error;
+    }
+
+    u32 skipped = 0;
+    vec<u32> destinations;
+
+    for (const auto& destination : parse_destinations(*text))
+    {
+        if (destination.address)
+            destinations.push_back(*destination.address);
+        else
+            ++skipped;
+    }
+
+    if (skipped != 0)
+        std::println(stderr, "Warning! {} destination/s are not IPv4 addresses", skipped);
+
+    auto routes = collect_ipv4_routes();
+
+    if (not routes)
+    {
+        std::println(stderr, "{}", to_string(routes.error()));
+        return exit_error;
+    }
+
+    auto plan = plan_nic_metric(interfaces, *nic_list, match);
+
+    Route_Table current;
+    Route_Table planned;
+
+    if (not current.build(*routes, current_interface_metrics(interfaces)) or
+        not planned.build(*routes, planned_interface_metrics(interfaces, plan)))
+    {
+        std::println(stderr, "[ERROR] route table too large");
+        return exit_error;
+    }
+
+    auto report = compare_egress(current, planned, destinations);
+
+    std::unordered_map<u64, str> name_of {{0, "no route"}};
+
+    for (const auto& nic : interfaces)
+        name_of.emplace(get_luid(nic), get_name(nic));
+
+    auto name = [&name_of](u64 luid)
+    {
+        auto it = name_of.find(luid);
+        return it == name_of.end() ? std::format("luid {}", luid) : it->second;
+    };
+
+    std::println("{} of {} destination/s would change egress interface ({:.1f} ms)",
+                 report.changed,
+                 report.destinations,
+                 double(report.elapsed_ns) / 1e6);
+
+    for (const auto& move : report.moves)
+        std::println("  {} -> {}: {}", name(move.from), name(move.to), move.destinations);
+
+    print_rule_errors(plan);
+
+    if (plan.skipped != 0)
+    {
+        std::println(stderr, "Warning! {} interface/s skipped", plan.skipped);
+        print_suggestions(interfaces, plan.unmatched);
+        return exit_skipped;
+    }
+
+    return exit_ok;
+}
+
+static int traffic_command(const vec<shared<Interface>>& interfaces, const vec<str>& args)
+{
+    u32 seconds = args.empty() ? 5 : static_cast<u32>(std::strtoul(args.front().c_str(), nullptr, 10));
+
+    Traffic_Sampler sampler;
+
+    // NOTE: the first sample is only the baseline
+    for (u32 i = 0; i <= seconds and not stop_requested; ++i)
+    {
+        if (i > 0)
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+
+        if (auto res = sampler.sample(); not res)
+        {
+            std::println(stderr, "{}", to_string(res.error()));
+            return exit_error;
+        }
+
+        if (i == 0)
+            continue;
+
+        for (const auto& nic : interfaces)
+        {
+            auto rate = sampler.latest(get_luid(nic));
+
+            if (not rate)
+                continue;
+
+            std::println("{:<40} rx {:>12} tx {:>12}",
+                         get_name(nic),
+                         format_rate(rate->rx_bytes),
+                         format_rate(rate->tx_bytes));
+        }
+
+        std::println("");
+        std::fflush(stdout);
+    }
+
+    return exit_ok;
+}
+
+static int probe_command(const vec<shared<Interface>>& interfaces, bool apply)
+{
+    auto probes = probe_gateways(interfaces);
+
+    if (not probes)
+    {
+        std::println(stderr, "{}", to_string(probes.error()));
+        return exit_error;
+    }
+
+    for (const auto& probe : *probes)
+    {
+        if (probe.gateway.empty())
+            continue;
+
+        if (probe.rtt_us)
+            std::println("{:<40} {:<16} {:.2f} ms", get_name(probe.nic), probe.gateway, double(*probe.rtt_us) / 1000.0);
+        else
+            std::println("{:<40} {:<16} no answer ({})", get_name(probe.nic), probe.gateway, probe.status);
+    }
+
+    auto ordered = order_by_gateway_latency(*probes);
+
+    std::println("");
+    for (const auto& nic : ordered)
+        std::println("{}", get_name(nic));
+
+    if (not apply)
+        return exit_ok;
+
+    if (auto res = apply_nic_metric_plan(plan_nic_metric(ordered)); not res)
+    {
+        std::println(stderr, "{}", to_string(res.error()));
+        return exit_error;
+    }
+
+    return exit_ok;
+}
+
+static void write_interface(Json_Writer& json, const shared<Interface>& nic)
+{
+    auto text = [&json](const char* key, str_cref value)
+    {
+        json.Key(key);
+        json.String(value.data(), static_cast<rapidjson::SizeType>(value.size()));
+    };
+
+    json.StartObject();
+    text("name", get_name(nic));
+    text("description", get_description(nic));
+    json.Key("luid"); json.Uint64(get_luid(nic));
+    json.Key("compartment"); json.Uint(get_compartment(nic));
+    text("ip", get_ip(nic));
+    json.Key("subnet"); json.Uint(get_subnet(nic));
+    text("gateway", get_gateway(nic));
+    text("dns", get_dns(nic));
+    text("dns_suffix", get_dns_suffix(nic));
+
+    auto metric = [&json](const char* key, std::optional<u32> value)
+    {
+        json.Key(key);
+
+        if (value)
+            json.Uint(*value);
+        else
+            json.Null();
+    };
+
+    metric("metric", get_metric(nic));
+    metric("metric_v6", get_metric_v6(nic));
+
+    json.Key("automatic_metric"); json.Bool(is_automatic_metric(nic));
+    json.Key("connected"); json.Bool(is_connected(nic));
+    json.EndObject();
+}
+
+static int export_command(const vec<shared<Interface>>& interfaces, const vec<str>& args)
+{
+    rapidjson::StringBuffer buffer;
+    Json_Writer json(buffer);
+
+    json.StartArray();
+    for (const auto& nic : interfaces)
+        write_interface(json, nic);
+    json.EndArray();
+
+    if (args.empty())
+    {
+        std::println("{}", buffer.GetString());
+        return exit_ok;
+    }
+
+    std::ofstream file(args.front(), std::ios::binary);
+
+    if (not file.write(buffer.GetString(), buffer.GetSize()))
+    {
+        std::println(stderr, "[ERROR] cannot write '{}'", args.front());
+        return exit_error;
+    }
+
+    return exit_ok;
+}
+
+static str socket_path(const Cli_Options& options)
+{
+    if (not options.socket_path.empty())
+        return options.socket_path;
+
+    std::error_code error;
+    auto temp = std::filesystem::temp_directory_path(error);
+
+    return (temp / "qtnic.sock").string();
+}
+
+static void install_stop_handlers()
+{
+    std::signal(SIGINT, [](int) { stop_requested = true; });
+    std::signal(SIGTERM, [](int) { stop_requested = true; });
+}
+
+// NOTE: kernel notifications only mark the snapshot stale, one thread
+// re-enumerates at most once per refresh_interval however many of them
+// arrive, the same idea as Change_Coalescer in the gui. Queries never
+// wait for it
+class Snapshot_Feeder
+{
+public:
+    static constexpr auto refresh_interval = std::chrono::milliseconds(16);
+
+    Snapshot_Feeder(Query_Server& server, const Nic_Filter& filter)
+        : server(server)
+        , filter(filter)
+        , refresher([this](std::stop_token stop) { run(stop); })
+    {
+    }
+
+    ~Snapshot_Feeder()
+    {
+        // no more notifications first, then the thread
+        watch.reset();
+        refresher.request_stop();
+        refresher.join();
+    }
+
+    void mark_stale()
+    {
+        {
+            std::scoped_lock lock(mutex);
+            stale = true;
+        }
+
+        wake.notify_one();
+    }
+
+    shared<Nic_Watch> watch;
+
+private:
+    void run(std::stop_token stop)
+    {
+        while (true)
+        {
+            {
+                std::unique_lock lock(mutex);
+
+                if (not wake.wait(lock, stop, [this]() { return stale; }))
+                    return;
+
+                stale = false;
+            }
+
+            if (auto fresh = collect_nic_info(filter))
+                server.publish(std::move(*fresh));
+
+            // whatever arrives meanwhile is picked up by the next round
+            std::this_thread::sleep_for(refresh_interval);
+        }
+    }
+
+    Query_Server& server;
+    Nic_Filter filter;
+    std::mutex mutex;
+    std::condition_variable_any wake;
+    bool stale {false};
+    std::jthread refresher; // last, everything it uses is ready by now
+};
+
+static Nic_Result<shared<Snapshot_Feeder>> feed_query_server(Query_Server& server,
+                                                             const Nic_Filter& filter)
+{
+    auto interfaces = collect_nic_info(filter);
+
+    if (not interfaces)
+        return std::unexpected(interfaces.error());
+
+    server.publish(std::move(*interfaces));
+
+    auto feeder = std::make_shared<Snapshot_Feeder>(server, filter);
+
+    auto watch = watch_nic_changes([feeder = feeder.get()](const Nic_Change&)
+    {
+        feeder->mark_stale();
+    });
+
+    if (not watch)
+        return std::unexpected(watch.error());
+
+    feeder->watch = std::move(*watch);
+    return feeder;
+}
+
+static Nic_Result<shared<Snapshot_Feeder>> start_query_server(const Cli_Options& options,
+                                                              Query_Server& server)
+{
+    auto feeder = feed_query_server(server, options.filter);
+
+    if (not feeder)
+        return feeder;
+
+    if (auto res = server.start(); not res)
+        return std::unexpected(res.error());
+
+    std::println(stderr, "serving queries on {}", socket_path(options));
+    return feeder;
+}
+
+static void print_daemon_stats(const Order_Enforcer& enforcer)
+{
+    std::println("events={} corrections={} failures={}",
+                 enforcer.events(),
+                 enforcer.corrections(),
+                 enforcer.failures());
+    std::println("  reaction {}", enforcer.reaction_latency().summary());
+    std::println("  check    {}", enforcer.check_latency().summary());
+    std::print("{}", nic_op_stats_text());
+
+    if (auto error = enforcer.last_error())
+        std::println(stderr, "{}", to_string(*error));
+
+    std::fflush(stdout);
+}
+
+static int daemon_command(const Cli_Options& options)
+{
+    auto nic_list = read_text(options.args.front());
+
+    if (not nic_list)
+    {
+        std::println(stderr, "[ERROR] cannot read '{}'", options.args.front());
+        return exit_error;
+    }
+
+    Order_Enforcer enforcer(*nic_list, options.match);
+
+    if (auto res = enforcer.start(); not res)
+    {
+        std::println(stderr, "{}", to_string(res.error()));
+        return exit_error;
+    }
+
+    Query_Server server(socket_path(options));
+    shared<Snapshot_Feeder> server_feeder;
+
+    if (options.serve)
+    {
+        auto feeder = start_query_server(options, server);
+
+        if (not feeder)
+        {
+            std::println(stderr, "{}", to_string(feeder.error()));
+            return exit_error;
+        }
+
+        server_feeder = std::move(*feeder);
+    }
+
+    install_stop_handlers();
+
+    // NOTE: all the work happens on the notification thread, this one
+    // only wakes up to print
+    using namespace std::chrono;
+    auto next_report = steady_clock::now() + seconds(options.report_seconds);
+
+    while (not stop_requested)
+    {
+        std::this_thread::sleep_for(milliseconds(100));
+
+        if (options.report_seconds != 0 and steady_clock::now() >= next_report)
+        {
+            print_daemon_stats(enforcer);
+            next_report += seconds(options.report_seconds);
+        }
+    }
+
+    server_feeder.reset();
+    server.stop();
+    enforcer.stop();
+    print_daemon_stats(enforcer);
+
+    if (options.serve)
+        std::println("  queries  {}", server.query_latency().summary());
+
+    return enforcer.failures() == 0 ? exit_ok : exit_error;
+}
+
+static int serve_command(const Cli_Options& options)
+{
+    Query_Server server(socket_path(options));
+    auto feeder = start_query_server(options, server);
+
+    if (not feeder)
+    {
+        std::println(stderr, "{}", to_string(feeder.error()));
+        return exit_error;
+    }
+
+    install_stop_handlers();
+
+    while (not stop_requested)
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+    feeder->reset();
+    server.stop();
+    std::println("queries {}", server.query_latency().summary());
+
+    return exit_ok;
+}
+
+static int run_command(const Cli_Options& options)
+{
+    bool needs_file = options.command == "diff" or
+                      options.command == "daemon" or
+                      options.command == "route";
+
+    if (needs_file and options.args.size() != 1)
+    {
+        print_usage();
+        return exit_usage;
+    }
+
+    if (options.command == "apply" and options.args.empty())
+    {
+        print_usage();
+        return exit_usage;
+    }
+
+    // NOTE: profiles are applied back to back to time each one, spreading
+    // a step over several workers would time something else
+    if (options.command == "apply" and options.args.size() > 1 and options.jobs > 1)
+    {
+        std::println(stderr, "--jobs only works with a single file");
+        return exit_usage;
+    }
+
+    if (options.command == "whatif" and options.args.size() != 2)
+    {
+        print_usage();
+        return exit_usage;
+    }
+
+    // NOTE: the daemon keeps every interface the list names, a filter
+    // could only narrow what its --serve answers
+    bool filtered = options.filter.connected_only or not options.filter.name_glob.empty();
+
+    if (options.command == "daemon" and filtered and not options.serve)
+    {
+        std::println(stderr, "--connected and --name only work with daemon --serve");
+        return exit_usage;
+    }
+
+    if ((options.command == "daemon" or options.command == "serve") and options.all_compartments)
+    {
+        std::println(stderr, "--all-compartments does not work with daemon and serve");
+        return exit_usage;
+    }
+
+    if (options.command == "daemon")
+    {
+        if (not is_running_as_administrator().value_or(false))
+            std::println(stderr, "Warning! not elevated, corrections will most likely fail");
+
+        return daemon_command(options);
+    }
+
+    if (options.command == "serve")
+        return serve_command(options);
+
+    // NOTE: writes go back to each interface's own compartment, so apply
+    // works across all of them as well
+    auto interfaces = options.all_compartments
+        ? collect_nic_info(list_network_compartments(), options.filter)
+        : collect_nic_info(options.filter);
+
+    if (not interfaces)
+    {
+        std::println(stderr, "{}", to_string(interfaces.error()));
+        return exit_error;
+    }
+
+    if (options.command == "list")
+        return list_command(*interfaces);
+
+    if (options.command == "apply")
+    {
+        if (not is_running_as_administrator().value_or(false))
+            std::println(stderr, "Warning! not elevated, apply will most likely fail");
+
+        if (options.args.size() > 1)
+            return apply_profiles_command(*interfaces, options.args, options.match);
+
+        if (options.jobs > 1)
+            return apply_parallel_command(*interfaces,
+                                          options.args.front(),
+                                          options.jobs,
+                                          options.match);
+
+        return apply_command(*interfaces, options.args.front(), options.match);
+    }
+
+    if (options.command == "diff")
+        return diff_command(*interfaces, options.args.front(), options.match);
+
+    if (options.command == "route")
+        return route_command(*interfaces, options.args.front());
+
+    if (options.command == "whatif")
+        return whatif_command(*interfaces, options.args, options.match);
+
+    if (options.command == "probe")
+        return probe_command(*interfaces, options.apply);
+
+    if (options.command == "traffic")
+    {
+        install_stop_handlers();
+        return traffic_command(*interfaces, options.args);
+    }
+
+    if (options.command == "export")
+        return export_command(*interfaces, options.args);
+
+    print_usage();
+    return exit_usage;
+}
+
+int main(int argc, char* argv[])
+{
+    Cli_Options options;
+
+    if (not parse_options(argc, argv, options))
+    {
+        print_usage();
+        return exit_usage;
+    }
+
+    int res = run_command(options);
+
+    if (options.stats)
+        std::print(stderr, "{}", nic_op_stats_text());
+
+    if (not options.trace_path.empty() and not write_chrome_trace(options.trace_path))
+        std::println(stderr, "[ERROR] cannot write '{}'", options.trace_path);
+
+    return res;
+}
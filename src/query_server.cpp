@@ -0,0 +1,355 @@
+#include "query_server.h"
+
+#include "nic_private.h"
+
+#include <afunix.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+
+using Json_Writer = rapidjson::Writer<rapidjson::StringBuffer>;
+using Clock = std::chrono::steady_clock;
+
+struct Query_Snapshot
+{
+    vec<shared<Interface>> interfaces; // lowest metric first
+    vec<wstr> wide_names;              // for glob_match()
+    vec<str> objects;                  // one json object per interface
+    str list_answer;
+    str order_answer;
+};
+
+static str interface_to_json(const shared<Interface>& nic)
+{
+    rapidjson::StringBuffer buffer;
+    Json_Writer json(buffer);
+
+    auto text = [&json](const char* key, str_cref value)
+    {
+        json.Key(key);
+        json.String(value.data(), static_cast<rapidjson::SizeType>(value.size()));
+    };
+
+    auto metric = [&json](const char* key, std::optional<u32> value)
+    {
+        json.Key(key);
+
+        if (value)
+            json.Uint(*value);
+        else
+            json.Null();
+    };
+
+    json.StartObject();
+    text("name", nic->name);
+    text("description", nic->description);
+    json.Key("luid"); json.Uint64(nic->luid.Value);
+    text("ip", nic->ip);
+    json.Key("subnet"); json.Uint(nic->subnet);
+    text("gateway", nic->gateway);
+    text("dns", nic->dns);
+    text("dns_suffix", nic->dns_suff);
+    metric("metric", get_metric(nic));
+    metric("metric_v6", get_metric_v6(nic));
+    json.Key("automatic_metric"); json.Bool(is_automatic_metric(nic));
+    json.Key("connected"); json.Bool(nic->connected);
+    json.EndObject();
+
+    return str(buffer.GetString(), buffer.GetSize());
+}
+
+static void append_array(str& out, const vec<str>& objects, const vec<bool>* keep = nullptr)
+{
+    out += '[';
+    bool first = true;
+
+    for (size_t i = 0; i < objects.size(); ++i)
+    {
+        if (keep and not (*keep)[i])
+            continue;
+
+        if (not first)
+            out += ',';
+
+        out += objects[i];
+        first = false;
+    }
+
+    out += "]\n";
+}
+
+static bool send_all(SOCKET s, str_cref data)
+{
+    size_t sent = 0;
+
+    while (sent < data.size())
+    {
+        int res = send(s, data.data() + sent, static_cast<int>(data.size() - sent), 0);
+
+        if (res == SOCKET_ERROR)
+            return false;
+
+        sent += static_cast<size_t>(res);
+    }
+
+    return true;
+}
+
+static Nic_Error socket_error()
+{
+    return Nic_Error {Nic_Errc::socket, static_cast<u32>(WSAGetLastError())};
+}
+
+Query_Server::Query_Server(str socket_path)
+    : path(std::move(socket_path))
+{
+    publish({});
+}
+
+Query_Server::~Query_Server()
+{
+    stop();
+}
+
+void Query_Server::publish(vec<shared<Interface>> interfaces)
+{
+    auto next = std::make_shared<Query_Snapshot>();
+
+    std::stable_sort(interfaces.begin(), interfaces.end(),
+                     [](const auto& a, const auto& b)
+                     {
+                         return effective_metric(a) < effective_metric(b);
+                     });
+
+    rapidjson::StringBuffer buffer;
+    Json_Writer order(buffer);
+    order.StartArray();
+
+    for (const auto& nic : interfaces)
+    {
+        next->wide_names.push_back(to_wide(nic->name));
+        next->objects.push_back(interface_to_json(nic));
+        order.String(nic->name.data(), static_cast<rapidjson::SizeType>(nic->name.size()));
+    }
+
+    order.EndArray();
+
+    append_array(next->list_answer, next->objects);
+    next->order_answer.assign(buffer.GetString(), buffer.GetSize());
+    next->order_answer += '\n';
+    next->interfaces = std::move(interfaces);
+
+    snapshot.store(std::move(next));
+}
+
+vec<shared<Interface>> Query_Server::interfaces() const
+{
+    return snapshot.load()->interfaces;
+}
+
+Nic_Result<void> Query_Server::start()
+{
+    static WSA_Startup wsa(MAKEWORD(2, 2));
+
+    if (wsa.res != 0)
+        return std::unexpected(Nic_Error {Nic_Errc::socket, static_cast<u32>(wsa.res)});
+
+    SOCKET s = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (s == INVALID_SOCKET)
+        return std::unexpected(socket_error());
+
+    sockaddr_un address {};
+    address.sun_family = AF_UNIX;
+    strncpy_s(address.sun_path, sizeof(address.sun_path), path.c_str(), _TRUNCATE);
+
+    // NOTE: a socket file left behind by a previous run makes bind fail
+    DeleteFileW(to_wide(path).c_str());
+
+    if (bind(s, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == SOCKET_ERROR or
+        listen(s, SOMAXCONN) == SOCKET_ERROR)
+    {
+        auto error = socket_error();
+        closesocket(s);
+        return std::unexpected(error);
+    }
+
+    listener = s;
+    listening = true;
+    acceptor = std::jthread([this] { accept_loop(); });
+
+    return {};
+}
+
+void Query_Server::stop()
+{
+    if (not listening)
+        return;
+
+    // NOTE: closing the listener is what wakes accept() up
+    listening = false;
+    closesocket(static_cast<SOCKET>(listener));
+
+    if (acceptor.joinable())
+        acceptor.join();
+
+    reap_connections(true);
+    DeleteFileW(to_wide(path).c_str());
+}
+
+void Query_Server::answer(string_view request, str& out) const
+{
+    auto started = Clock::now();
+    auto current = snapshot.load();
+
+    if (request == "list")
+    {
+        out += current->list_answer;
+    }
+    else if (request == "order")
+    {
+        out += current->order_answer;
+    }
+    else if (request == "stats")
+    {
+        out += nic_op_stats_json();
+        out += '\n';
+    }
+    else if (request.starts_with("filter "))
+    {
+        auto glob = to_wide(str(request.substr(7)));
+        vec<bool> keep(current->objects.size());
+
+        for (size_t i = 0; i < keep.size(); ++i)
+            keep[i] = glob_match(glob.c_str(), current->wide_names[i].c_str());
+
+        append_array(out, current->objects, &keep);
+    }
+    else
+    {
+        out += R"({"error":"unknown request"})" "\n";
+    }
+
+    ++request_count;
+    latency.record(static_cast<u64>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - started).count()));
+}
+
+u64 Query_Server::requests() const
+{
+    return request_count.load();
+}
+
+const Latency_Histogram& Query_Server::query_latency() const
+{
+    return latency;
+}
+
+void Query_Server::accept_loop()
+{
+    while (true)
+    {
+        SOCKET client = accept(static_cast<SOCKET>(listener), nullptr, nullptr);
+
+        if (client == INVALID_SOCKET)
+        {
+            if (not listening)
+                return;
+
+            continue;
+        }
+
+        reap_connections(false);
+
+        std::scoped_lock lock(connections_mutex);
+        auto& connection = connections.emplace_back();
+        connection.socket = client;
+        connection.thread = std::jthread([this, &connection] { serve(connection); });
+    }
+}
+
+void Query_Server::serve(Connection& connection)
+{
+    // NOTE: a request longer than this is not a request
+    constexpr size_t max_pending = 64 * 1024;
+
+    auto s = static_cast<SOCKET>(connection.socket);
+    char buffer[16 * 1024];
+    str pending;
+    str out;
+
+    while (true)
+    {
+        int received = recv(s, buffer, sizeof(buffer), 0);
+
+        if (received <= 0)
+            break;
+
+        pending.append(buffer, static_cast<size_t>(received));
+        out.clear();
+
+        // NOTE: every complete line in the buffer is answered, the rest
+        // waits for the next recv
+        size_t start = 0;
+        size_t end = 0;
+
+        while ((end = pending.find('\n', start)) != str::npos)
+        {
+            string_view line(pending.data() + start, end - start);
+
+            if (line.ends_with('\r'))
+                line.remove_suffix(1);
+
+            if (not line.empty())
+                answer(line, out);
+
+            start = end + 1;
+        }
+
+        pending.erase(0, start);
+
+        if (pending.size() > max_pending)
+            break;
+
+        if (not send_all(s, out))
+            break;
+    }
+
+    // NOTE: the socket is closed by reap_connections(), after the join,
+    // so stop() can never shut down a handle that was already reused
+    connection.done = true;
+}
+
+void Query_Server::reap_connections(bool all)
+{
+    std::list<Connection> finished;
+
+    {
+        std::scoped_lock lock(connections_mutex);
+
+        for (auto it = connections.begin(); it != connections.end();)
+        {
+            auto next = std::next(it);
+
+            if (all or it->done)
+                finished.splice(finished.end(), connections, it);
+
+            it = next;
+        }
+    }
+
+    for (auto& connection : finished)
+    {
+        auto s = static_cast<SOCKET>(connection.socket);
+
+        // wakes up a recv() that is still waiting for requests
+        if (not connection.done)
+            shutdown(s, SD_BOTH);
+
+        connection.thread.join();
+        closesocket(s);
+    }
+}
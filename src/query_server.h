@@ -0,0 +1,77 @@
+#ifndef QUERY_SERVER_H
+#define QUERY_SERVER_H
+
+#include <atomic>
+#include <list>
+#include <mutex>
+#include <thread>
+
+#include "metrics.h"
+#include "nic.h"
+
+struct Query_Snapshot;
+
+// NOTE: answers other tools from an in-memory snapshot over a unix
+// domain socket, so they stop enumerating adapters themselves.
+// One request per line, one line of compact json per answer, in order:
+//
+//   list            every interface, lowest metric first
+//   order           just the names, lowest metric first
+//   filter <glob>   like list, only names matching the glob
+//   stats           call counts and latencies of this process, see metrics.h
+//
+// A client can write as many requests as it likes before reading, all
+// the answers to one read go back in a single send
+class Query_Server
+{
+public:
+    explicit Query_Server(str socket_path);
+    ~Query_Server();
+
+    Query_Server(const Query_Server&) = delete;
+    Query_Server& operator=(const Query_Server&) = delete;
+
+    // NOTE: builds the answers once here, queries only copy bytes
+    void publish(vec<shared<Interface>> interfaces);
+    vec<shared<Interface>> interfaces() const;
+
+    Nic_Result<void> start();
+    void stop();
+
+    // appends the answer to one request line, newline included
+    void answer(string_view request, str& out) const;
+
+    u64 requests() const;
+    const Latency_Histogram& query_latency() const;
+
+private:
+    // NOTE: sockets are SOCKET on windows, kept opaque like the rest of
+    // the windows types
+    using Socket = std::uintptr_t;
+
+    struct Connection
+    {
+        Socket socket {};
+        std::atomic<bool> done {false};
+        std::jthread thread;
+    };
+
+    void accept_loop();
+    void serve(Connection& connection);
+    void reap_connections(bool all);
+
+    str path;
+    std::atomic<shared<const Query_Snapshot>> snapshot;
+
+    Socket listener {};
+    std::atomic<bool> listening {false};
+    std::jthread acceptor;
+
+    std::mutex connections_mutex;
+    std::list<Connection> connections;
+
+    mutable std::atomic<u64> request_count {0};
+    mutable Latency_Histogram latency;
+};
+
+#endif // QUERY_SERVER_H
@@ -0,0 +1,364 @@
+#include "route_table.h"
+
+#include "nic_private.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <format>
+#include <map>
+#include <mutex>
+#include <thread>
+
+std::optional<Ipv4_Prefix> parse_ipv4_prefix(string_view text)
+{
+    Ipv4_Prefix prefix {};
+    const char* it = text.data();
+    const char* end = text.data() + text.size();
+
+    for (int octet = 0; octet < 4; ++octet)
+    {
+        if (octet > 0)
+        {
+            if (it == end or *it != '.')
+                return std::nullopt;
+            ++it;
+        }
+
+        u32 value = 0;
+        auto [next, ec] = std::from_chars(it, end, value);
+
+        if (ec != std::errc() or next == it or value > 255)
+            return std::nullopt;
+
+        prefix.address = (prefix.address << 8) | value;
+        it = next;
+    }
+
+    if (it != end)
+    {
+        u32 length = 0;
+
+        if (*it != '/')
+            return std::nullopt;
+
+        auto [next, ec] = std::from_chars(it + 1, end, length);
+
+        if (ec != std::errc() or next != end or length > 32)
+            return std::nullopt;
+
+        prefix.length = static_cast<u8>(length);
+    }
+
+    // NOTE: host bits are ignored, 10.1.2.3/16 is 10.1.0.0/16
+    if (prefix.length < 32)
+        prefix.address &= prefix.length == 0 ? 0 : ~0u << (32 - prefix.length);
+
+    return prefix;
+}
+
+str ipv4_to_string(u32 address)
+{
+    return std::format("{}.{}.{}.{}",
+                       address >> 24, (address >> 16) & 0xFF,
+                       (address >> 8) & 0xFF, address & 0xFF);
+}
+
+Nic_Result<vec<Route_Entry>> collect_ipv4_routes()
+{
+    QTNIC_TRACE_SCOPE("collect_ipv4_routes");
+
+    MIB_IPFORWARD_TABLE2* table = nullptr;
+    DWORD result = GetIpForwardTable2(AF_INET, &table);
+
+    if (result != NO_ERROR)
+        return std::unexpected(Nic_Error {Nic_Errc::get_ip_forward_table, result});
+
+    vec<Route_Entry> routes;
+    routes.reserve(table->NumEntries);
+
+    for (ULONG i = 0; i < table->NumEntries; ++i)
+    {
+        const auto& row = table->Table[i];
+
+        Route_Entry route {};
+        route.prefix.address = ntohl(row.DestinationPrefix.Prefix.Ipv4.sin_addr.s_addr);
+        route.prefix.length = row.DestinationPrefix.PrefixLength;
+        route.metric = row.Metric;
+        route.luid = row.InterfaceLuid.Value;
+        routes.push_back(route);
+    }
+
+    FreeMibTable(table);
+    return routes;
+}
+
+Interface_Metrics current_interface_metrics(const vec<shared<Interface>>& interfaces)
+{
+    Interface_Metrics metrics;
+    metrics.reserve(interfaces.size());
+
+    for (const auto& nic : interfaces)
+    {
+        if (nic->ipv4_enabled)
+            metrics.emplace(nic->luid.Value, nic->metric);
+    }
+
+    return metrics;
+}
+
+Interface_Metrics planned_interface_metrics(const vec<shared<Interface>>& interfaces,
+                                            const Metric_Plan& plan)
+{
+    auto metrics = current_interface_metrics(interfaces);
+
+    for (const auto& write : plan.writes)
+    {
+        if (write.nic->ipv4_enabled)
+            metrics.insert_or_assign(write.nic->luid.Value, write.new_metric);
+    }
+
+    return metrics;
+}
+
+bool Route_Table::build(const vec<Route_Entry>& routes, const Interface_Metrics& interface_metrics)
+{
+    QTNIC_TRACE_SCOPE("Route_Table::build");
+
+    struct Candidate
+    {
+        Ipv4_Prefix prefix;
+        u64 cost;
+        u64 luid;
+    };
+
+    // NOTE: an interface we know nothing about only costs its route metric
+    vec<Candidate> candidates;
+    candidates.reserve(routes.size());
+
+    for (const auto& route : routes)
+    {
+        auto it = interface_metrics.find(route.luid);
+        u64 cost = u64(route.metric) + (it == interface_metrics.end() ? 0 : it->second);
+
+        Ipv4_Prefix prefix = route.prefix;
+        if (prefix.length < 32)
+            prefix.address &= prefix.length == 0 ? 0 : ~0u << (32 - prefix.length);
+
+        candidates.push_back({prefix, cost, route.luid});
+    }
+
+    // shortest prefixes first so longer ones paint over them, the
+    // cheapest route of each prefix first so it is the one kept
+    std::sort(candidates.begin(), candidates.end(),
+              [](const Candidate& a, const Candidate& b)
+              {
+                  if (a.prefix.length != b.prefix.length)
+                      return a.prefix.length < b.prefix.length;
+                  if (a.prefix.address != b.prefix.address)
+                      return a.prefix.address < b.prefix.address;
+                  if (a.cost != b.cost)
+                      return a.cost < b.cost;
+                  return a.luid < b.luid; // ties broken the same way every time
+              });
+
+    tbl24.assign(size_t(1) << 24, 0);
+    tbl8.clear();
+    egress_luid.assign(1, 0);
+    prefixes = 0;
+
+    std::unordered_map<u64, u16> egress_id;
+
+    for (size_t i = 0; i < candidates.size(); ++i)
+    {
+        const auto& candidate = candidates[i];
+
+        if (i > 0 and
+            candidates[i - 1].prefix.length == candidate.prefix.length and
+            candidates[i - 1].prefix.address == candidate.prefix.address)
+        {
+            continue;
+        }
+
+        auto [it, added] = egress_id.try_emplace(candidate.luid,
+                                                 static_cast<u16>(egress_luid.size()));
+        if (added)
+        {
+            if (egress_luid.size() >= block_flag)
+                return false;
+
+            egress_luid.push_back(candidate.luid);
+        }
+
+        u16 id = it->second;
+        u32 address = candidate.prefix.address;
+        u8 length = candidate.prefix.length;
+
+        ++prefixes;
+
+        if (length <= 24)
+        {
+            size_t first = address >> 8;
+            size_t count = size_t(1) << (24 - length);
+            std::fill_n(tbl24.begin() + first, count, id);
+            continue;
+        }
+
+        u16& slot = tbl24[address >> 8];
+
+        if (not (slot & block_flag))
+        {
+            size_t block = tbl8.size() / 256;
+
+            if (block >= block_flag)
+                return false;
+
+            // NOTE: the block starts out as whatever the /24 said
+            tbl8.resize(tbl8.size() + 256, slot);
+            slot = static_cast<u16>(block_flag | block);
+        }
+
+        size_t base = size_t(slot & ~block_flag) * 256;
+        size_t first = address & 0xFF;
+        size_t count = size_t(1) << (32 - length);
+        std::fill_n(tbl8.begin() + base + first, count, id);
+    }
+
+    return true;
+}
+
+u16 Route_Table::egress_of(u32 address) const
+{
+    u16 entry = tbl24[address >> 8];
+
+    if (entry & block_flag)
+        entry = tbl8[size_t(entry & ~block_flag) * 256 + (address & 0xFF)];
+
+    return entry;
+}
+
+u64 Route_Table::lookup(u32 address) const
+{
+    if (tbl24.empty())
+        return 0;
+
+    return egress_luid[egress_of(address)];
+}
+
+void Route_Table::lookup(std::span<const u32> addresses, std::span<u64> luids) const
+{
+    assert(luids.size() >= addresses.size());
+
+    if (tbl24.empty())
+    {
+        std::fill(luids.begin(), luids.end(), 0);
+        return;
+    }
+
+    // NOTE: the tables are far bigger than the caches, so every lookup
+    // is a cache miss or two; in a batch the loads of consecutive
+    // addresses are independent and the cpu overlaps them
+    for (size_t i = 0; i < addresses.size(); ++i)
+        luids[i] = egress_luid[egress_of(addresses[i])];
+}
+
+size_t Route_Table::prefix_count() const
+{
+    return prefixes;
+}
+
+Egress_Report compare_egress(const Route_Table& current,
+                             const Route_Table& planned,
+                             std::span<const u32> destinations,
+                             u32 threads)
+{
+    QTNIC_TRACE_SCOPE("compare_egress");
+
+    using Clock = std::chrono::steady_clock;
+    using Moves = std::map<std::pair<u64, u64>, u64>;
+
+    // NOTE: chunks are big enough to amortize the atomic, batches small
+    // enough that both result arrays stay in L1
+    constexpr size_t chunk_size = 64 * 1024;
+    constexpr size_t batch_size = 512;
+
+    auto started = Clock::now();
+
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+
+    size_t chunk_count = (destinations.size() + chunk_size - 1) / chunk_size;
+    threads = static_cast<u32>(std::min<size_t>(threads, std::max<size_t>(chunk_count, 1)));
+
+    std::atomic<size_t> next_chunk {0};
+    std::mutex merge_mutex;
+    Moves moves;
+    u64 changed = 0;
+
+    auto worker = [&]()
+    {
+        std::array<u64, batch_size> before;
+        std::array<u64, batch_size> after;
+        Moves local_moves;
+        u64 local_changed = 0;
+
+        for (size_t chunk = next_chunk++; chunk < chunk_count; chunk = next_chunk++)
+        {
+            size_t end = std::min(destinations.size(), (chunk + 1) * chunk_size);
+
+            for (size_t first = chunk * chunk_size; first < end; first += batch_size)
+            {
+                auto batch = destinations.subspan(first, std::min(batch_size, end - first));
+
+                current.lookup(batch, before);
+                planned.lookup(batch, after);
+
+                for (size_t i = 0; i < batch.size(); ++i)
+                {
+                    if (before[i] == after[i])
+                        continue;
+
+                    ++local_changed;
+                    ++local_moves[{before[i], after[i]}];
+                }
+            }
+        }
+
+        std::scoped_lock lock(merge_mutex);
+        changed += local_changed;
+
+        for (const auto& [key, count] : local_moves)
+            moves[key] += count;
+    };
+
+    {
+        vec<std::jthread> pool;
+        pool.reserve(threads);
+
+        for (u32 i = 1; i < threads; ++i)
+            pool.emplace_back(worker);
+
+        worker();
+    }
+
+    Egress_Report report {};
+    report.destinations = destinations.size();
+    report.changed = changed;
+
+    for (const auto& [key, count] : moves)
+        report.moves.push_back({key.first, key.second, count});
+
+    std::sort(report.moves.begin(), report.moves.end(),
+              [](const Egress_Move& a, const Egress_Move& b)
+              {
+                  return a.destinations > b.destinations;
+              });
+
+    report.elapsed_ns = static_cast<u64>(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - started).count());
+
+    return report;
+}
@@ -0,0 +1,90 @@
+#ifndef ROUTE_TABLE_H
+#define ROUTE_TABLE_H
+
+#include <span>
+#include <unordered_map>
+
+#include "nic.h"
+
+// NOTE: IPv4 only for now, addresses and prefixes in host byte order
+struct Ipv4_Prefix
+{
+    u32 address {0};
+    u8 length {32};
+};
+
+struct Route_Entry
+{
+    Ipv4_Prefix prefix;
+    u32 metric {0}; // the route's own metric, the interface one is added later
+    u64 luid {0};
+};
+
+// NOTE: "10.1.2.3" or "10.1.0.0/16", a bare address is a /32
+std::optional<Ipv4_Prefix> parse_ipv4_prefix(string_view text);
+str ipv4_to_string(u32 address);
+
+// NOTE: the IPv4 forwarding table of the current compartment
+Nic_Result<vec<Route_Entry>> collect_ipv4_routes();
+
+// NOTE: interface metric by luid, what windows adds to the route metric
+using Interface_Metrics = std::unordered_map<u64, u32>;
+Interface_Metrics current_interface_metrics(const vec<shared<Interface>>& interfaces);
+
+// NOTE: what the metrics would be once the plan is applied
+Interface_Metrics planned_interface_metrics(const vec<shared<Interface>>& interfaces,
+                                            const Metric_Plan& plan);
+
+// NOTE: which interface a destination leaves through. Longest prefix wins,
+// between routes for the same prefix the lowest route + interface metric.
+// DIR-24-8: the top 24 bits index a flat table, prefixes longer than /24
+// get a 256 entry block of their own, so a lookup is one or two loads
+class Route_Table
+{
+public:
+    // NOTE: false if there are more than 32767 egress interfaces or
+    // /25../32 blocks, way beyond any real host
+    bool build(const vec<Route_Entry>& routes, const Interface_Metrics& interface_metrics);
+
+    u64 lookup(u32 address) const; // luid of the egress interface, 0 if no route
+    void lookup(std::span<const u32> addresses, std::span<u64> luids) const;
+
+    size_t prefix_count() const;
+
+private:
+    u16 egress_of(u32 address) const;
+
+    static constexpr u16 block_flag = 0x8000;
+
+    vec<u16> tbl24;       // 1 << 24 entries, egress id or block_flag | block
+    vec<u16> tbl8;        // 256 entries per block
+    vec<u64> egress_luid; // egress id -> luid, id 0 is "no route"
+    size_t prefixes {0};
+};
+
+struct Egress_Move
+{
+    u64 from {0}; // luid, 0 is "no route"
+    u64 to {0};
+    u64 destinations {0};
+};
+
+struct Egress_Report
+{
+    u64 destinations {0};
+    u64 changed {0};
+    vec<Egress_Move> moves; // most destinations first
+    u64 elapsed_ns {0};
+};
+
+// NOTE: what-if for a reorder: the same destinations through two tables
+// built from the same routes, e.g. with current_interface_metrics() and
+// planned_interface_metrics(). Split in chunks over a few threads, each
+// resolving fixed size batches through both tables before comparing them.
+// threads == 0 uses one per core
+Egress_Report compare_egress(const Route_Table& current,
+                             const Route_Table& planned,
+                             std::span<const u32> destinations,
+                             u32 threads = 0);
+
+#endif // ROUTE_TABLE_H
@@ -0,0 +1,145 @@
+#include "trace.h"
+
+#include <chrono>
+#include <fstream>
+#include <mutex>
+
+#include "rapidjson/stringbuffer.h"
+#include "rapidjson/writer.h"
+
+struct Trace_Event
+{
+    const char* name;
+    u64 start_ns;
+    u64 duration_ns;
+};
+
+// NOTE: one per thread. The owning thread is the only writer, the lock
+// is only ever contended while the trace is being written out
+struct Trace_Buffer
+{
+    u32 tid {0};
+    std::mutex mutex;
+    vec<Trace_Event> events;
+};
+
+struct Retired_Event
+{
+    u32 tid;
+    Trace_Event event;
+};
+
+struct Trace_Registry
+{
+    std::mutex mutex;
+    vec<Trace_Buffer*> buffers; // threads still running
+    vec<Retired_Event> retired; // events of threads that are gone
+    u32 next_tid {1};
+    std::chrono::steady_clock::time_point epoch {std::chrono::steady_clock::now()};
+};
+
+static Trace_Registry& registry()
+{
+    static Trace_Registry instance;
+    return instance;
+}
+
+static u64 now_ns()
+{
+    return static_cast<u64>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - registry().epoch).count());
+}
+
+// NOTE: when a thread exits only its events are kept, the buffer and
+// its spare capacity go away with it
+struct Thread_Buffer
+{
+    Thread_Buffer()
+    {
+        auto& r = registry();
+        buffer.events.reserve(4096);
+
+        std::scoped_lock lock(r.mutex);
+        buffer.tid = r.next_tid++;
+        r.buffers.push_back(&buffer);
+    }
+
+    ~Thread_Buffer()
+    {
+        auto& r = registry();
+        std::scoped_lock lock(r.mutex, buffer.mutex);
+
+        for (const auto& event : buffer.events)
+            r.retired.push_back({buffer.tid, event});
+
+        std::erase(r.buffers, &buffer);
+    }
+
+    Trace_Buffer buffer;
+};
+
+static Trace_Buffer& thread_buffer()
+{
+    // NOTE: registry() is constructed first, so it outlives this
+    thread_local Thread_Buffer owned;
+    return owned.buffer;
+}
+
+Trace_Scope::Trace_Scope(const char* name)
+    : name(name)
+    , start_ns(now_ns())
+{
+}
+
+Trace_Scope::~Trace_Scope()
+{
+    u64 end_ns = now_ns();
+    auto& buffer = thread_buffer();
+
+    std::scoped_lock lock(buffer.mutex);
+    buffer.events.push_back({name, start_ns, end_ns - start_ns});
+}
+
+bool write_chrome_trace(str_cref path)
+{
+    rapidjson::StringBuffer out;
+    rapidjson::Writer<rapidjson::StringBuffer> json(out);
+
+    json.StartObject();
+    json.Key("displayTimeUnit"); json.String("ns");
+    json.Key("traceEvents");
+    json.StartArray();
+
+    // NOTE: timestamps are in microseconds, fractions are fine
+    auto write_event = [&json](u32 tid, const Trace_Event& event)
+    {
+        json.StartObject();
+        json.Key("name"); json.String(event.name);
+        json.Key("ph"); json.String("X");
+        json.Key("ts"); json.Double(double(event.start_ns) / 1000.0);
+        json.Key("dur"); json.Double(double(event.duration_ns) / 1000.0);
+        json.Key("pid"); json.Uint(1);
+        json.Key("tid"); json.Uint(tid);
+        json.EndObject();
+    };
+
+    auto& r = registry();
+    std::scoped_lock registry_lock(r.mutex);
+
+    for (const auto& retired : r.retired)
+        write_event(retired.tid, retired.event);
+
+    for (auto* buffer : r.buffers)
+    {
+        std::scoped_lock lock(buffer->mutex);
+
+        for (const auto& event : buffer->events)
+            write_event(buffer->tid, event);
+    }
+
+    json.EndArray();
+    json.EndObject();
+
+    std::ofstream file(path, std::ios::binary);
+    return static_cast<bool>(file.write(out.GetString(), out.GetSize()));
+}
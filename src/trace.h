@@ -0,0 +1,39 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "nic.h"
+
+// NOTE: scoped spans for chrome://tracing / Perfetto. Without QTNIC_TRACE
+// (cmake -DQTNIC_TRACE=ON) QTNIC_TRACE_SCOPE expands to nothing, so the
+// spans cost nothing in a normal build. With it a span is two clock reads
+// and a push_back into a buffer owned by the calling thread.
+// The name must outlive the program, i.e. a string literal
+
+#ifdef QTNIC_TRACE
+#define QTNIC_TRACE_CONCAT_(a, b) a##b
+#define QTNIC_TRACE_CONCAT(a, b) QTNIC_TRACE_CONCAT_(a, b)
+#define QTNIC_TRACE_SCOPE(name) \
+    Trace_Scope QTNIC_TRACE_CONCAT(trace_scope_, __COUNTER__)(name)
+#else
+#define QTNIC_TRACE_SCOPE(name) ((void)0)
+#endif
+
+class Trace_Scope
+{
+public:
+    explicit Trace_Scope(const char* name);
+    ~Trace_Scope();
+
+    Trace_Scope(const Trace_Scope&) = delete;
+    Trace_Scope& operator=(const Trace_Scope&) = delete;
+
+private:
+    const char* name;
+    u64 start_ns;
+};
+
+// NOTE: every span recorded so far, from every thread, as chrome trace
+// event json. Returns false if the file cannot be written
+bool write_chrome_trace(str_cref path);
+
+#endif // TRACE_H
@@ -0,0 +1,118 @@
+#include "traffic_sampler.h"
+
+#include "nic_private.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <format>
+
+Nic_Result<void> Traffic_Sampler::sample()
+{
+    QTNIC_TRACE_SCOPE("Traffic_Sampler::sample");
+
+    // NOTE: the table itself is allocated by the os on every call, there
+    // is no variant that fills a buffer we own
+    MIB_IF_TABLE2* table = nullptr;
+    DWORD result = GetIfTable2(&table);
+
+    if (result != NO_ERROR)
+        return std::unexpected(Nic_Error {Nic_Errc::get_if_table, result});
+
+    auto now = Clock::now();
+    ++samples;
+
+    for (ULONG i = 0; i < table->NumEntries; ++i)
+    {
+        const auto& row = table->Table[i];
+
+        // NOTE: every adapter comes with a handful of filter interfaces
+        // carrying the same traffic, only the real one is kept
+        if (row.InterfaceAndOperStatusFlags.FilterInterface)
+            continue;
+
+        Counters counters {
+            row.InOctets,
+            row.OutOctets,
+            row.InUcastPkts + row.InNUcastPkts,
+            row.OutUcastPkts + row.OutNUcastPkts};
+
+        auto [it, added] = histories.try_emplace(row.InterfaceLuid.Value);
+        auto& history = it->second;
+        history.seen = samples;
+
+        if (not added)
+        {
+            float seconds = std::chrono::duration<float>(now - history.last_time).count();
+
+            // a counter that went backwards was reset, count it as idle
+            auto rate = [seconds](u64 current, u64 last)
+            {
+                return current < last or seconds <= 0 ? 0.0f : float(current - last) / seconds;
+            };
+
+            history.ring[history.head] = {
+                rate(counters.rx_bytes, history.last.rx_bytes),
+                rate(counters.tx_bytes, history.last.tx_bytes),
+                rate(counters.rx_packets, history.last.rx_packets),
+                rate(counters.tx_packets, history.last.tx_packets)};
+
+            history.head = (history.head + 1) % history_size;
+            history.count = std::min<u32>(history.count + 1, history_size);
+        }
+
+        history.last = counters;
+        history.last_time = now;
+    }
+
+    FreeMibTable(table);
+
+    // interfaces that are gone
+    std::erase_if(histories, [this](const auto& entry)
+    {
+        return entry.second.seen != samples;
+    });
+
+    return {};
+}
+
+std::optional<Traffic_Rate> Traffic_Sampler::latest(u64 luid) const
+{
+    auto it = histories.find(luid);
+
+    if (it == histories.end() or it->second.count == 0)
+        return std::nullopt;
+
+    const auto& history = it->second;
+    return history.ring[(history.head + history_size - 1) % history_size];
+}
+
+size_t Traffic_Sampler::history(u64 luid, std::span<Traffic_Rate> out) const
+{
+    auto it = histories.find(luid);
+
+    if (it == histories.end())
+        return 0;
+
+    const auto& history = it->second;
+    size_t count = std::min<size_t>(history.count, out.size());
+    size_t first = (history.head + history_size - count) % history_size;
+
+    for (size_t i = 0; i < count; ++i)
+        out[i] = history.ring[(first + i) % history_size];
+
+    return count;
+}
+
+str format_rate(float bytes_per_second)
+{
+    constexpr const char* units[] = {"B/s", "KB/s", "MB/s", "GB/s"};
+    size_t unit = 0;
+
+    while (bytes_per_second >= 1000.0f and unit + 1 < std::size(units))
+    {
+        bytes_per_second /= 1000.0f;
+        ++unit;
+    }
+
+    return std::format("{:.1f} {}", bytes_per_second, units[unit]);
+}
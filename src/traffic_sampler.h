@@ -0,0 +1,64 @@
+#ifndef TRAFFIC_SAMPLER_H
+#define TRAFFIC_SAMPLER_H
+
+#include <array>
+#include <chrono>
+#include <span>
+#include <unordered_map>
+
+#include "nic.h"
+
+struct Traffic_Rate
+{
+    float rx_bytes {0}; // per second
+    float tx_bytes {0};
+    float rx_packets {0};
+    float tx_packets {0};
+};
+
+// NOTE: rx/tx counters of every interface from one GetIfTable2 call per
+// sample, turned into per second rates kept in a fixed ring per interface.
+// Memory is constant per interface and a sample allocates nothing of its
+// own, only an interface seen for the first time adds an entry.
+// Not thread safe, sample and read from the same thread
+class Traffic_Sampler
+{
+public:
+    static constexpr size_t history_size = 60;
+
+    Nic_Result<void> sample();
+
+    std::optional<Traffic_Rate> latest(u64 luid) const;
+
+    // oldest first, returns how many were written
+    size_t history(u64 luid, std::span<Traffic_Rate> out) const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    struct Counters
+    {
+        u64 rx_bytes {0};
+        u64 tx_bytes {0};
+        u64 rx_packets {0};
+        u64 tx_packets {0};
+    };
+
+    struct History
+    {
+        Counters last;
+        Clock::time_point last_time;
+        std::array<Traffic_Rate, history_size> ring {};
+        u32 head {0};  // next slot to write
+        u32 count {0};
+        u64 seen {0};  // sample that last reported this interface
+    };
+
+    std::unordered_map<u64, History> histories;
+    u64 samples {0};
+};
+
+// NOTE: "1.2 MB/s" style, for the cli
+str format_rate(float bytes_per_second);
+
+#endif // TRAFFIC_SAMPLER_H